@@ -1,15 +1,27 @@
 #include "LLVMWrapper.h"
 
+#include <mutex>
+
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Object/Archive.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Object/ArchiveWriter.h"
 #include "llvm/Support/Path.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 using namespace llvm;
 using namespace llvm::object;
 
 struct RustArchiveMember {
   const char *Filename;
   const char *Name;
+  // Member contents supplied directly from memory; empty when the member
+  // comes from a file or an existing archive child instead.
+  StringRef Data;
   Archive::Child Child;
 
   RustArchiveMember()
@@ -40,11 +52,15 @@ enum class LLVMRustArchiveKind {
   DARWIN,
   COFF,
   AIX_BIG,
+  // A GNU archive that stores member paths instead of member contents, for
+  // intermediate artifacts that never leave the build directory.
+  GNU_THIN,
 };
 
 static Archive::Kind fromRust(LLVMRustArchiveKind Kind) {
   switch (Kind) {
   case LLVMRustArchiveKind::GNU:
+  case LLVMRustArchiveKind::GNU_THIN:
     return Archive::K_GNU;
   case LLVMRustArchiveKind::BSD:
     return Archive::K_BSD;
@@ -87,6 +103,62 @@ extern "C" LLVMRustArchiveRef LLVMRustOpenArchive(char *Path) {
   return Ret;
 }
 
+// Tells the kernel how a region of a mapped archive is about to be
+// accessed. Best-effort: the start is rounded down to a page boundary as
+// madvise requires, and failures (e.g. when the buffer was read into heap
+// memory rather than mapped) are ignored.
+enum class ArchiveAdvice { Sequential, WillNeed };
+
+static void adviseRange(const void *Ptr, size_t Len, ArchiveAdvice Advice) {
+#if defined(__unix__) || defined(__APPLE__)
+  int Flag =
+      Advice == ArchiveAdvice::Sequential ? MADV_SEQUENTIAL : MADV_WILLNEED;
+  uintptr_t PageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+  uintptr_t Start = (uintptr_t)Ptr & ~PageMask;
+  (void)madvise((void *)Start, Len + ((uintptr_t)Ptr - Start), Flag);
+#else
+  (void)Ptr;
+  (void)Len;
+  (void)Advice;
+#endif
+}
+
+// Like LLVMRustOpenArchive, but tuned for scanning large, cold archives:
+// the file is mapped without null-terminator requirements (which can force
+// a full private-memory read), the mapping is marked for sequential access
+// since member iteration walks it front to back, and the symbol table is
+// marked WILLNEED so lookups don't fault a page at a time. With `Prefetch`
+// set, WILLNEED covers the whole file, which starts kernel readahead in the
+// background while the caller is still looking at the symbol table.
+extern "C" LLVMRustArchiveRef LLVMRustOpenArchiveMapped(char *Path,
+                                                        bool Prefetch) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOr = MemoryBuffer::getFile(
+      Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (!BufOr) {
+    LLVMRustSetLastError(BufOr.getError().message().c_str());
+    return nullptr;
+  }
+
+  StringRef Data = BufOr.get()->getBuffer();
+  if (Prefetch)
+    adviseRange(Data.data(), Data.size(), ArchiveAdvice::WillNeed);
+  adviseRange(Data.data(), Data.size(), ArchiveAdvice::Sequential);
+
+  Expected<std::unique_ptr<Archive>> ArchiveOr =
+      Archive::create(BufOr.get()->getMemBufferRef());
+  if (!ArchiveOr) {
+    LLVMRustSetLastError(toString(ArchiveOr.takeError()).c_str());
+    return nullptr;
+  }
+
+  StringRef Symtab = ArchiveOr.get()->getSymbolTable();
+  if (!Symtab.empty())
+    adviseRange(Symtab.data(), Symtab.size(), ArchiveAdvice::WillNeed);
+
+  return new OwningBinary<Archive>(std::move(ArchiveOr.get()),
+                                   std::move(BufOr.get()));
+}
+
 extern "C" void LLVMRustDestroyArchive(LLVMRustArchiveRef RustArchive) {
   delete RustArchive;
 }
@@ -134,6 +206,30 @@ LLVMRustArchiveIteratorNext(LLVMRustArchiveIteratorRef RAI) {
   return Ret;
 }
 
+// Like LLVMRustArchiveIteratorNext, but the returned child lives in `Arena`
+// and is released with it; do not pass it to LLVMRustArchiveChildFree.
+extern "C" LLVMRustArchiveChildConstRef
+LLVMRustArchiveIteratorNextInArena(LLVMRustArena *Arena,
+                                   LLVMRustArchiveIteratorRef RAI) {
+  if (RAI->Cur == RAI->End)
+    return nullptr;
+
+  if (!RAI->First) {
+    ++RAI->Cur;
+    if (*RAI->Err) {
+      LLVMRustSetLastError(toString(std::move(*RAI->Err)).c_str());
+      return nullptr;
+    }
+  } else {
+    RAI->First = false;
+  }
+
+  if (RAI->Cur == RAI->End)
+    return nullptr;
+
+  return Arena->create<Archive::Child>(*RAI->Cur.operator->());
+}
+
 extern "C" void LLVMRustArchiveChildFree(LLVMRustArchiveChildRef Child) {
   delete Child;
 }
@@ -142,6 +238,51 @@ extern "C" void LLVMRustArchiveIteratorFree(LLVMRustArchiveIteratorRef RAI) {
   delete RAI;
 }
 
+static void writeU64LE(raw_ostream &OS, uint64_t Value) {
+  char Buf[8];
+  support::endian::write64le(Buf, Value);
+  OS.write(Buf, sizeof(Buf));
+}
+
+// Walks the whole archive in one call and writes a packed record per child
+// into `RecordsOut`, replacing the per-child iterator/name/free FFI round
+// trips. Each record is `name_len:u64le, name bytes, data_offset:u64le,
+// data_len:u64le`, where the data offset is relative to the start of the
+// archive's buffer, so rustc can slice member contents out of its own mapping
+// with zero per-child allocations.
+extern "C" LLVMRustResult
+LLVMRustArchiveListChildren(LLVMRustArchiveRef RustArchive,
+                            RustStringRef RecordsOut) {
+  Archive *Archive = RustArchive->getBinary();
+  const char *BufStart = Archive->getData().begin();
+  RawRustStringOstream OS(RecordsOut);
+
+  Error Err = Error::success();
+  for (const auto &Child : Archive->children(Err)) {
+    Expected<StringRef> NameOrErr = Child.getName();
+    if (!NameOrErr) {
+      LLVMRustSetLastError(toString(NameOrErr.takeError()).c_str());
+      consumeError(std::move(Err));
+      return LLVMRustResult::Failure;
+    }
+    Expected<StringRef> DataOrErr = Child.getBuffer();
+    if (!DataOrErr) {
+      LLVMRustSetLastError(toString(DataOrErr.takeError()).c_str());
+      consumeError(std::move(Err));
+      return LLVMRustResult::Failure;
+    }
+    writeU64LE(OS, NameOrErr->size());
+    OS << *NameOrErr;
+    writeU64LE(OS, DataOrErr->begin() - BufStart);
+    writeU64LE(OS, DataOrErr->size());
+  }
+  if (Err) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
 extern "C" const char *
 LLVMRustArchiveChildName(LLVMRustArchiveChildConstRef Child, size_t *Size) {
   Expected<StringRef> NameOrErr = Child->getName();
@@ -168,6 +309,36 @@ LLVMRustArchiveMemberNew(char *Filename, char *Name,
   return Member;
 }
 
+// Like LLVMRustArchiveMemberNew, but the member lives in `Arena` and is
+// released with it; do not pass the result to LLVMRustArchiveMemberFree.
+extern "C" LLVMRustArchiveMemberRef
+LLVMRustArchiveMemberNewInArena(LLVMRustArena *Arena, char *Filename,
+                                char *Name, LLVMRustArchiveChildRef Child) {
+  RustArchiveMember *Member = Arena->create<RustArchiveMember>();
+  Member->Filename = Filename;
+  Member->Name = Name;
+  if (Child)
+    Member->Child = *Child;
+  return Member;
+}
+
+// Creates a member directly from bytes rustc already holds in memory.
+// rustc typically has each object loaded anyway - it just produced it, or
+// read it to extract symbols via LLVMRustGetSymbols - and going back
+// through a filename makes the archive writer open and map the same file a
+// second time. `Data` is borrowed and must stay alive until the archive is
+// written. Note this only deduplicates the I/O: LLVM's writeArchive offers
+// no way to hand it precomputed symbols, so with WriteSymbtab set it still
+// parses each member's symbol table itself.
+extern "C" LLVMRustArchiveMemberRef
+LLVMRustArchiveMemberNewFromBuffer(char *Name, const char *Data,
+                                   size_t Len) {
+  RustArchiveMember *Member = new RustArchiveMember;
+  Member->Name = Name;
+  Member->Data = StringRef(Data, Len);
+  return Member;
+}
+
 extern "C" void LLVMRustArchiveMemberFree(LLVMRustArchiveMemberRef Member) {
   delete Member;
 }
@@ -176,34 +347,128 @@ extern "C" LLVMRustResult
 LLVMRustWriteArchive(char *Dst, size_t NumMembers,
                      const LLVMRustArchiveMemberRef *NewMembers,
                      bool WriteSymbtab, LLVMRustArchiveKind RustKind) {
+  LLVM_RUST_TIME_ENTRY_POINT();
 
-  std::vector<NewArchiveMember> Members;
+  // Member loading opens and maps one file per member, which is
+  // I/O-serialized if done inline; fan it out over a thread pool and fill the
+  // vector by index so the member order in the final archive is unchanged.
+  std::vector<NewArchiveMember> Members(NumMembers);
   auto Kind = fromRust(RustKind);
+  bool Thin = RustKind == LLVMRustArchiveKind::GNU_THIN;
 
+  std::mutex ErrorMutex;
+  std::string FirstError;
+
+  WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
   for (size_t I = 0; I < NumMembers; I++) {
-    auto Member = NewMembers[I];
-    assert(Member->Name);
-    if (Member->Filename) {
-      Expected<NewArchiveMember> MOrErr =
-          NewArchiveMember::getFile(Member->Filename, true);
-      if (!MOrErr) {
-        LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
-        return LLVMRustResult::Failure;
+    Pool.async([&, I] {
+      auto Member = NewMembers[I];
+      assert(Member->Name);
+      if (Member->Data.data()) {
+        Members[I] =
+            NewArchiveMember(MemoryBufferRef(Member->Data, Member->Name));
+        return;
       }
-      MOrErr->MemberName = sys::path::filename(MOrErr->MemberName);
-      Members.push_back(std::move(*MOrErr));
-    } else {
       Expected<NewArchiveMember> MOrErr =
-          NewArchiveMember::getOldMember(Member->Child, true);
+          Member->Filename ? NewArchiveMember::getFile(Member->Filename, true)
+                           : NewArchiveMember::getOldMember(Member->Child, true);
       if (!MOrErr) {
-        LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
-        return LLVMRustResult::Failure;
+        std::lock_guard<std::mutex> Lock(ErrorMutex);
+        if (FirstError.empty())
+          FirstError = toString(MOrErr.takeError());
+        else
+          consumeError(MOrErr.takeError());
+        return;
       }
-      Members.push_back(std::move(*MOrErr));
+      // Thin archives refer to their members by path, so the path must not be
+      // stripped down to the filename there.
+      if (Member->Filename && !Thin)
+        MOrErr->MemberName = sys::path::filename(MOrErr->MemberName);
+      Members[I] = std::move(*MOrErr);
+    });
+  }
+  Pool.wait();
+
+  if (!FirstError.empty()) {
+    LLVMRustSetLastError(FirstError.c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, Thin);
+  if (!Result)
+    return LLVMRustResult::Success;
+  LLVMRustSetLastError(toString(std::move(Result)).c_str());
+
+  return LLVMRustResult::Failure;
+}
+
+// Incrementally updates an existing archive: members whose name matches one
+// of `NewMembers` are replaced, the rest are carried over zero-copy from the
+// mapped input archive, and members with previously unseen names are
+// appended. This still rewrites the output file (LLVM's archive writer can't
+// patch regions in place), but it avoids re-opening and re-reading every
+// unchanged member from disk the way a full LLVMRustWriteArchive does.
+extern "C" LLVMRustResult
+LLVMRustUpdateArchive(char *Dst, LLVMRustArchiveRef RustArchive,
+                      size_t NumMembers,
+                      const LLVMRustArchiveMemberRef *NewMembers,
+                      bool WriteSymbtab, LLVMRustArchiveKind RustKind) {
+  auto Kind = fromRust(RustKind);
+  bool Thin = RustKind == LLVMRustArchiveKind::GNU_THIN;
+
+  StringSet<> ReplacedNames;
+  for (size_t I = 0; I < NumMembers; I++) {
+    assert(NewMembers[I]->Name);
+    ReplacedNames.insert(NewMembers[I]->Name);
+  }
+
+  std::vector<NewArchiveMember> Members;
+
+  Archive *Archive = RustArchive->getBinary();
+  Error Err = Error::success();
+  for (const auto &Child : Archive->children(Err)) {
+    Expected<StringRef> NameOrErr = Child.getName();
+    if (!NameOrErr) {
+      LLVMRustSetLastError(toString(NameOrErr.takeError()).c_str());
+      consumeError(std::move(Err));
+      return LLVMRustResult::Failure;
+    }
+    if (ReplacedNames.contains(*NameOrErr))
+      continue;
+    Expected<NewArchiveMember> MOrErr =
+        NewArchiveMember::getOldMember(Child, true);
+    if (!MOrErr) {
+      LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
+      consumeError(std::move(Err));
+      return LLVMRustResult::Failure;
+    }
+    Members.push_back(std::move(*MOrErr));
+  }
+  if (Err) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  for (size_t I = 0; I < NumMembers; I++) {
+    auto Member = NewMembers[I];
+    if (Member->Data.data()) {
+      Members.push_back(
+          NewArchiveMember(MemoryBufferRef(Member->Data, Member->Name)));
+      continue;
+    }
+    Expected<NewArchiveMember> MOrErr =
+        Member->Filename ? NewArchiveMember::getFile(Member->Filename, true)
+                         : NewArchiveMember::getOldMember(Member->Child, true);
+    if (!MOrErr) {
+      LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
+      return LLVMRustResult::Failure;
     }
+    if (Member->Filename && !Thin)
+      MOrErr->MemberName = sys::path::filename(MOrErr->MemberName);
+    Members.push_back(std::move(*MOrErr));
   }
 
-  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, false);
+  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, Thin);
   if (!Result)
     return LLVMRustResult::Success;
   LLVMRustSetLastError(toString(std::move(Result)).c_str());
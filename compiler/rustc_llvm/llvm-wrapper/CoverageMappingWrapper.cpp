@@ -3,8 +3,14 @@
 #include "llvm/ProfileData/Coverage/CoverageMappingWriter.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
 
 using namespace llvm;
 
@@ -102,6 +108,41 @@ fromRust(LLVMRustCounterExprKind Kind) {
   report_fatal_error("Bad LLVMRustCounterExprKind!");
 }
 
+// Drops mapping regions whose removal cannot change what a reader computes,
+// before they are encoded. Two cases are provably safe:
+//
+// - duplicate CodeRegions with a structurally-zero counter: readers *sum*
+//   the counts of regions covering an identical span, and summing an extra
+//   zero is a no-op;
+// - duplicate SkippedRegions: they carry no counts at all.
+//
+// Everything else is kept. BranchRegions are never pruned even when both
+// sides are zero, because each one contributes an entry to branch-coverage
+// totals; GapRegions are kept because their presence (not just their count)
+// affects how llvm-cov renders whitespace between statements.
+static void pruneMappingRegions(
+    SmallVectorImpl<coverage::CounterMappingRegion> &MappingRegions) {
+  std::set<std::array<uint32_t, 6>> Seen;
+  MappingRegions.erase(
+      std::remove_if(
+          MappingRegions.begin(), MappingRegions.end(),
+          [&](const coverage::CounterMappingRegion &Region) {
+            bool ZeroCode =
+                Region.Kind == coverage::CounterMappingRegion::CodeRegion &&
+                Region.Count.isZero();
+            bool Skipped =
+                Region.Kind == coverage::CounterMappingRegion::SkippedRegion;
+            if (!ZeroCode && !Skipped)
+              return false;
+            return !Seen
+                        .insert({(uint32_t)Region.Kind, Region.FileID,
+                                 Region.LineStart, Region.ColumnStart,
+                                 Region.LineEnd, Region.ColumnEnd})
+                        .second;
+          }),
+      MappingRegions.end());
+}
+
 extern "C" void LLVMRustCoverageWriteFilenamesSectionToBuffer(
     const char* const Filenames[],
     size_t FilenamesLen,
@@ -135,6 +176,7 @@ extern "C" void LLVMRustCoverageWriteMappingToBuffer(
         Region.LineStart, Region.ColumnStart, Region.LineEnd, Region.ColumnEnd,
         fromRust(Region.Kind));
   }
+  pruneMappingRegions(MappingRegions);
 
   std::vector<coverage::CounterExpression> Expressions;
   Expressions.reserve(NumExpressions);
@@ -153,11 +195,156 @@ extern "C" void LLVMRustCoverageWriteMappingToBuffer(
   CoverageMappingWriter.write(OS);
 }
 
+// A filenames section encoded once and shared across codegen units. Every
+// CGU of a crate carries the same filename list, so re-encoding (and
+// re-compressing) it per CGU is pure waste; instead the first request
+// encodes it and later requests with the same list get the cached buffer
+// back. Entries are owned by a process-wide cache keyed by the packed
+// filename list and stay valid until LLVMRustCoverageFilenamesCacheClear.
+struct LLVMRustCoverageFilenamesBuffer {
+  std::string Data;
+  uint64_t Hash;
+};
+
+static struct {
+  std::mutex Lock;
+  StringMap<std::unique_ptr<LLVMRustCoverageFilenamesBuffer>> Buffers;
+} FilenamesCache;
+
+extern "C" const LLVMRustCoverageFilenamesBuffer *
+LLVMRustCoverageFilenamesSectionGet(const char *const Filenames[],
+                                    size_t FilenamesLen) {
+  // Key on the NUL-separated filename list so lookups don't need to encode.
+  std::string Key;
+  for (size_t i = 0; i < FilenamesLen; i++) {
+    Key.append(Filenames[i]);
+    Key.push_back('\0');
+  }
+
+  std::lock_guard<std::mutex> Guard(FilenamesCache.Lock);
+  auto &Entry = FilenamesCache.Buffers[Key];
+  if (!Entry) {
+    SmallVector<std::string, 32> FilenameRefs;
+    FilenameRefs.reserve(FilenamesLen);
+    for (size_t i = 0; i < FilenamesLen; i++) {
+      FilenameRefs.push_back(std::string(Filenames[i]));
+    }
+    auto FilenamesWriter = coverage::CoverageFilenamesSectionWriter(
+        ArrayRef<std::string>(FilenameRefs));
+    Entry = std::make_unique<LLVMRustCoverageFilenamesBuffer>();
+    raw_string_ostream OS(Entry->Data);
+    FilenamesWriter.write(OS);
+    OS.flush();
+    Entry->Hash = IndexedInstrProf::ComputeHash(Entry->Data);
+  }
+  return Entry.get();
+}
+
+extern "C" const char *
+LLVMRustCoverageFilenamesBufferPtr(const LLVMRustCoverageFilenamesBuffer *Buffer) {
+  return Buffer->Data.data();
+}
+
+extern "C" size_t
+LLVMRustCoverageFilenamesBufferLen(const LLVMRustCoverageFilenamesBuffer *Buffer) {
+  return Buffer->Data.size();
+}
+
+extern "C" uint64_t
+LLVMRustCoverageFilenamesBufferHash(const LLVMRustCoverageFilenamesBuffer *Buffer) {
+  return Buffer->Hash;
+}
+
+extern "C" void LLVMRustCoverageFilenamesCacheClear() {
+  std::lock_guard<std::mutex> Guard(FilenamesCache.Lock);
+  FilenamesCache.Buffers.clear();
+}
+
+// Like LLVMRustCoverageWriteMappingToBuffer, but encodes every function's
+// mapping in one call. The per-function argument arrays are packed
+// back-to-back, with `Num*PerFunction` giving each function's slice length.
+// All encodings land concatenated in `BufferOut`; `LengthsOut` (one entry
+// per function) receives each encoding's byte length so the caller can
+// split the buffer back into per-function `__llvm_covfun` records. The
+// conversion scratch vectors are allocated once and reused across
+// functions instead of being rebuilt for every FFI call.
+extern "C" void LLVMRustCoverageWriteMappingsToBuffer(
+    const unsigned *VirtualFileMappingIDs,
+    const unsigned *NumVirtualFileMappingIDsPerFunction,
+    const LLVMRustCounterExpression *RustExpressions,
+    const unsigned *NumExpressionsPerFunction,
+    const LLVMRustCounterMappingRegion *RustMappingRegions,
+    const unsigned *NumMappingRegionsPerFunction,
+    size_t NumFunctions,
+    size_t *LengthsOut,
+    RustStringRef BufferOut) {
+  SmallVector<coverage::CounterMappingRegion, 0> MappingRegions;
+  std::vector<coverage::CounterExpression> Expressions;
+  RawRustStringOstream OS(BufferOut);
+
+  for (size_t Fn = 0; Fn < NumFunctions; Fn++) {
+    unsigned NumVirtualFileMappingIDs = NumVirtualFileMappingIDsPerFunction[Fn];
+    unsigned NumExpressions = NumExpressionsPerFunction[Fn];
+    unsigned NumMappingRegions = NumMappingRegionsPerFunction[Fn];
+
+    // Convert from FFI representation to LLVM representation.
+    MappingRegions.clear();
+    MappingRegions.reserve(NumMappingRegions);
+    for (const auto &Region : ArrayRef<LLVMRustCounterMappingRegion>(
+             RustMappingRegions, NumMappingRegions)) {
+      MappingRegions.emplace_back(
+          fromRust(Region.Count), fromRust(Region.FalseCount),
+          Region.FileID, Region.ExpandedFileID,
+          Region.LineStart, Region.ColumnStart, Region.LineEnd,
+          Region.ColumnEnd, fromRust(Region.Kind));
+    }
+    pruneMappingRegions(MappingRegions);
+
+    Expressions.clear();
+    Expressions.reserve(NumExpressions);
+    for (const auto &Expression : ArrayRef<LLVMRustCounterExpression>(
+             RustExpressions, NumExpressions)) {
+      Expressions.emplace_back(fromRust(Expression.Kind),
+                               fromRust(Expression.LHS),
+                               fromRust(Expression.RHS));
+    }
+
+    uint64_t Start = OS.tell();
+    auto CoverageMappingWriter = coverage::CoverageMappingWriter(
+        ArrayRef<unsigned>(VirtualFileMappingIDs, NumVirtualFileMappingIDs),
+        Expressions,
+        MappingRegions);
+    CoverageMappingWriter.write(OS);
+    LengthsOut[Fn] = OS.tell() - Start;
+
+    VirtualFileMappingIDs += NumVirtualFileMappingIDs;
+    RustExpressions += NumExpressions;
+    RustMappingRegions += NumMappingRegions;
+  }
+}
+
 extern "C" LLVMValueRef LLVMRustCoverageCreatePGOFuncNameVar(LLVMValueRef F, const char *FuncName) {
   StringRef FuncNameRef(FuncName);
   return wrap(createPGOFuncNameVar(*cast<Function>(unwrap(F)), FuncNameRef));
 }
 
+// Batch version of `LLVMRustCoverageCreatePGOFuncNameVar`: instrumented
+// crates create one name variable per covered function, and doing that as a
+// single pass saves an FFI round trip for each. `FuncNames` are packed
+// back-to-back, with `FuncNameLens[i]` giving the byte length of the `i`th
+// name (the names are not NUL-terminated). The created globals are written
+// to `VarsOut`, parallel to the inputs.
+extern "C" void LLVMRustCoverageCreatePGOFuncNameVars(
+    const LLVMValueRef *Fs, const char *FuncNames, const size_t *FuncNameLens,
+    size_t NumFuncs, LLVMValueRef *VarsOut) {
+  for (size_t I = 0; I < NumFuncs; I++) {
+    StringRef FuncNameRef(FuncNames, FuncNameLens[I]);
+    VarsOut[I] =
+        wrap(createPGOFuncNameVar(*cast<Function>(unwrap(Fs[I])), FuncNameRef));
+    FuncNames += FuncNameLens[I];
+  }
+}
+
 extern "C" uint64_t LLVMRustCoverageHashCString(const char *StrVal) {
   StringRef StrRef(StrVal);
   return IndexedInstrProf::ComputeHash(StrRef);
@@ -170,6 +357,24 @@ extern "C" uint64_t LLVMRustCoverageHashByteArray(
   return IndexedInstrProf::ComputeHash(StrRef);
 }
 
+// Hashes a batch of byte strings in one FFI call. `Bytes` holds all names
+// packed back-to-back and `Offsets` has NumNames + 1 entries delimiting
+// them, so name `i` is `Bytes[Offsets[i]..Offsets[i + 1]]`. Writes one
+// hash per name into `HashesOut`. This exists so per-function coverage
+// setup hashes every name in a single crossing instead of one call per
+// function; the hash itself is the same IndexedInstrProf::ComputeHash
+// (MD5) the single-name entry points use.
+extern "C" void LLVMRustCoverageHashByteArrays(
+    const char *Bytes,
+    const size_t *Offsets,
+    size_t NumNames,
+    uint64_t *HashesOut) {
+  for (size_t i = 0; i < NumNames; i++) {
+    StringRef StrRef(Bytes + Offsets[i], Offsets[i + 1] - Offsets[i]);
+    HashesOut[i] = IndexedInstrProf::ComputeHash(StrRef);
+  }
+}
+
 static void WriteSectionNameToString(LLVMModuleRef M,
                                      InstrProfSectKind SK,
                                      RustStringRef Str) {
@@ -3,7 +3,9 @@
 #include "llvm-c/Object.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Analysis/Lint.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/IR/IRBuilder.h"
@@ -16,6 +18,7 @@
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/JSON.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Memory.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
@@ -36,6 +39,13 @@
 
 #include "llvm/IR/LegacyPassManager.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <vector>
+
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 
@@ -99,12 +109,92 @@ enum LLVMRustAttribute {
   SanitizeSafeStack = 40,
 };
 
+// Opt-in instrumentation for the wrapper's FFI entry points: a call counter
+// and a coarse latency histogram per instrumented function, cheap enough
+// (two relaxed atomic adds and a clock read per call when enabled, one
+// relaxed load when disabled) to leave compiled into production rustc.
+// Entry points opt in by placing LLVM_RUST_TIME_ENTRY_POINT() at the top of
+// their body; the function-local static self-registers in a lock-free list
+// the dump walks. Collection is off until LLVMRustWrapperStatsEnable(true),
+// and LLVMRustDumpWrapperStats reports everything gathered so far as JSON.
+extern std::atomic<bool> LLVMRustWrapperStatsEnabled;
+
+struct alignas(64) LLVMRustWrapperStatsEntry {
+  // Histogram buckets are powers of two of microseconds: bucket 0 is < 1us,
+  // bucket N is [2^(N-1), 2^N) us, and the last bucket absorbs the tail.
+  static const unsigned NumBuckets = 16;
+
+  const char *Name;
+  LLVMRustWrapperStatsEntry *Next;
+  std::atomic<uint64_t> Calls{0};
+  std::atomic<uint64_t> Buckets[NumBuckets] = {};
+
+  explicit LLVMRustWrapperStatsEntry(const char *Name);
+};
+
+class LLVMRustWrapperStatsTimer {
+  LLVMRustWrapperStatsEntry &Entry;
+  bool Active;
+  std::chrono::steady_clock::time_point Start;
+
+public:
+  explicit LLVMRustWrapperStatsTimer(LLVMRustWrapperStatsEntry &Entry)
+      : Entry(Entry),
+        Active(LLVMRustWrapperStatsEnabled.load(std::memory_order_relaxed)) {
+    if (Active)
+      Start = std::chrono::steady_clock::now();
+  }
+
+  ~LLVMRustWrapperStatsTimer() {
+    if (!Active)
+      return;
+    uint64_t Micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - Start)
+                          .count();
+    unsigned Bucket = Micros == 0 ? 0 : llvm::Log2_64(Micros) + 1;
+    if (Bucket >= LLVMRustWrapperStatsEntry::NumBuckets)
+      Bucket = LLVMRustWrapperStatsEntry::NumBuckets - 1;
+    Entry.Calls.fetch_add(1, std::memory_order_relaxed);
+    Entry.Buckets[Bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+#define LLVM_RUST_TIME_ENTRY_POINT()                                           \
+  static LLVMRustWrapperStatsEntry ThisEntryPointStats(__func__);              \
+  LLVMRustWrapperStatsTimer ThisEntryPointTimer(ThisEntryPointStats)
+
+// A bump arena for the small wrapper objects some entry points hand back
+// across the FFI boundary (operand bundles, archive members, archive
+// children). rustc creates one per codegen session and passes it to the
+// arena-taking constructor variants, then releases everything with a single
+// LLVMRustArenaFree instead of one malloc/free pair per object. Destructors
+// of non-trivial objects are remembered and run when the arena is freed, so
+// arena-allocated objects must never be passed to the per-object Free
+// entry points.
+struct LLVMRustArena {
+  llvm::BumpPtrAllocator Alloc;
+  llvm::SmallVector<std::pair<void *, void (*)(void *)>, 0> Dtors;
+
+  template <typename T, typename... ArgTypes> T *create(ArgTypes &&...Args) {
+    T *Ptr = new (Alloc.Allocate<T>()) T(std::forward<ArgTypes>(Args)...);
+    if (!std::is_trivially_destructible<T>::value)
+      Dtors.push_back({Ptr, [](void *P) { static_cast<T *>(P)->~T(); }});
+    return Ptr;
+  }
+
+  ~LLVMRustArena() {
+    for (auto &Dtor : llvm::reverse(Dtors))
+      Dtor.second(Dtor.first);
+  }
+};
+
 typedef struct OpaqueRustString *RustStringRef;
 typedef struct LLVMOpaqueTwine *LLVMTwineRef;
 typedef struct LLVMOpaqueSMDiagnostic *LLVMSMDiagnosticRef;
 
 extern "C" void LLVMRustStringWriteImpl(RustStringRef Str, const char *Ptr,
                                         size_t Size);
+extern "C" void LLVMRustStringReserveImpl(RustStringRef Str, size_t Additional);
 
 class RawRustStringOstream : public llvm::raw_ostream {
   RustStringRef Str;
@@ -117,6 +207,12 @@ class RawRustStringOstream : public llvm::raw_ostream {
 
   uint64_t current_pos() const override { return Pos; }
 
+  size_t preferred_buffer_size() const override {
+    // Batch small prints into page-sized writes so large payloads don't
+    // cross the FFI boundary one fragment at a time.
+    return 4096;
+  }
+
 public:
   explicit RawRustStringOstream(RustStringRef Str) : Str(Str), Pos(0) {}
 
@@ -124,4 +220,112 @@ public:
     // LLVM requires this.
     flush();
   }
+
+  // Announces the number of bytes about to be written so the Rust-side
+  // vector can allocate once instead of growing repeatedly.
+  void reserve(size_t Additional) { LLVMRustStringReserveImpl(Str, Additional); }
+};
+
+// Scheduling class for work on the shared wrapper thread pool. Workers
+// always drain the most urgent non-empty queue first, so latency-critical
+// jobs run ahead of bulk work; running jobs are not preempted.
+enum class LLVMRustJobPriority {
+  // Work a compilation thread is blocked on right now.
+  Codegen = 0,
+  // Thin-link and other batch analysis work whose caller waits at a
+  // barrier rather than per job.
+  ThinLink = 1,
+  // Write-back and other work nothing waits on until a flush.
+  BackgroundIO = 2,
+};
+
+// Submits one job to the shared pool (implemented in PassWrapper.cpp).
+// The pool self-initializes with the hardware parallelism on first use;
+// LLVMRustConfigureThreadPool sets the thread count if called before
+// that, which is how rustc bounds total wrapper concurrency alongside its
+// own codegen scheduler. Jobs must never block on other pool jobs - every
+// entry point submits from its caller's thread and waits there.
+std::shared_future<void> wrapperPoolSubmit(LLVMRustJobPriority Priority,
+                                           std::function<void()> Job);
+
+// Parallelism the pool was (or would be) created with; used by call sites
+// that chunk their work by worker count.
+size_t wrapperPoolConcurrency();
+
+// Fork/join helper over the shared pool, mirroring how the per-call
+// llvm::ThreadPool instances were used before the pool was shared: submit
+// a batch, then wait for all of it.
+class WrapperTaskGroup {
+  LLVMRustJobPriority Priority;
+  std::vector<std::shared_future<void>> Jobs;
+
+public:
+  explicit WrapperTaskGroup(LLVMRustJobPriority Priority)
+      : Priority(Priority) {}
+
+  void async(std::function<void()> Job) {
+    Jobs.push_back(wrapperPoolSubmit(Priority, std::move(Job)));
+  }
+
+  void wait() {
+    for (auto &Job : Jobs)
+      Job.wait();
+    Jobs.clear();
+  }
+
+  ~WrapperTaskGroup() { wait(); }
+};
+
+// Small-string fast path for returning bytes to Rust. Most string returns
+// (type names, symbol names, short diagnostics) are a few dozen bytes, yet
+// the RustStringRef protocol pays an FFI callback, a RefCell borrow and a
+// heap append even for those. The caller allocates this struct with `Len`
+// zeroed; payloads that fit in `Buf` are written straight into it and never
+// go through a callback. Anything larger spills to the embedded
+// RustStringRef via the usual write protocol, with `Len` set to `SpilledLen`
+// so the caller knows to read the heap string instead. The Rust side must
+// mirror this layout exactly.
+struct LLVMRustInlineString {
+  enum : size_t { BufSize = 64, SpilledLen = ~(size_t)0 };
+  char Buf[BufSize];
+  size_t Len;
+  RustStringRef Spill;
+};
+
+class RawRustInlineStringOstream : public llvm::raw_ostream {
+  LLVMRustInlineString *Str;
+  uint64_t Pos;
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    if (Str->Len != LLVMRustInlineString::SpilledLen) {
+      if (Str->Len + Size <= LLVMRustInlineString::BufSize) {
+        memcpy(Str->Buf + Str->Len, Ptr, Size);
+        Str->Len += Size;
+        Pos += Size;
+        return;
+      }
+      // Overflowed the inline buffer: move what is already inline to the
+      // heap string, then stream the rest there.
+      LLVMRustStringWriteImpl(Str->Spill, Str->Buf, Str->Len);
+      Str->Len = LLVMRustInlineString::SpilledLen;
+    }
+    LLVMRustStringWriteImpl(Str->Spill, Ptr, Size);
+    Pos += Size;
+  }
+
+  uint64_t current_pos() const override { return Pos; }
+
+public:
+  explicit RawRustInlineStringOstream(LLVMRustInlineString *Str)
+      : Str(Str), Pos(0) {
+    Str->Len = 0;
+    // Writes land in Buf with a plain memcpy; an intermediate heap buffer
+    // would cost more than it saves on these payloads.
+    SetUnbuffered();
+  }
+
+  ~RawRustInlineStringOstream() {
+    // LLVM requires this.
+    flush();
+  }
 };
@@ -1,7 +1,11 @@
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/Linker/Linker.h"
 
 #include "LLVMWrapper.h"
 
+#include <vector>
+
 using namespace llvm;
 
 struct RustLinker {
@@ -46,3 +50,205 @@ LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len) {
   }
   return true;
 }
+
+// Extracts a module's link interface - the symbols it defines and the
+// symbols it references but leaves undefined - from its bitcode without
+// materializing any function bodies. Both lists are written NUL-separated.
+// This feeds the incremental fat-LTO path on the Rust side: rustc keys the
+// result by the module's content hash, and when a rebuild's interfaces all
+// match the previous build it can reuse the prior link result instead of
+// redoing resolution. The resolution itself can't be made incremental
+// here - Linker/IRMover only expose whole-module linking - so the cheap,
+// cacheable interface extraction is the piece the wrapper provides.
+extern "C" bool
+LLVMRustLinkerGetSymbols(RustLinker *L, char *BC, size_t Len,
+                         RustStringRef DefinedOut,
+                         RustStringRef UndefinedOut) {
+  std::unique_ptr<MemoryBuffer> Buf = MemoryBuffer::getMemBuffer(
+      StringRef(BC, Len), "", /*RequiresNullTerminator=*/false);
+
+  // A throwaway context: the module is only inspected, never linked, and
+  // keeping it out of the destination context avoids growing its uniquing
+  // tables.
+  LLVMContext Ctx;
+  Expected<std::unique_ptr<Module>> SrcOrError =
+      llvm::getLazyBitcodeModule(Buf->getMemBufferRef(), Ctx);
+  if (!SrcOrError) {
+    LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
+    return false;
+  }
+
+  RawRustStringOstream DefOS(DefinedOut);
+  RawRustStringOstream UndefOS(UndefinedOut);
+  for (const GlobalValue &GV : (*SrcOrError)->global_values()) {
+    if (!GV.hasName() || GV.hasLocalLinkage())
+      continue;
+    raw_ostream &OS = GV.isDeclaration() ? UndefOS : DefOS;
+    OS << GV.getName() << '\0';
+  }
+  return true;
+}
+
+// Merges already-materialized modules into `Dst` without a bitcode
+// round-trip, for coalescing tiny codegen units before optimization: with
+// many codegen units the fixed per-module pipeline and emission setup can
+// dominate, and linking a handful of sub-threshold modules into one
+// right-sized unit is far cheaper than paying that setup per module. All
+// modules must live in the same LLVMContext - IR cannot cross contexts -
+// and the sources are consumed whether or not linking succeeds. Which
+// modules are small enough to merge is the caller's policy (rustc already
+// has cost estimates via LLVMRustModuleCost and its own size model).
+extern "C" bool
+LLVMRustMergeModules(LLVMModuleRef DstRef, LLVMModuleRef *SrcRefs,
+                     size_t NumSrcs) {
+  Module *Dst = unwrap(DstRef);
+  for (size_t I = 0; I < NumSrcs; I++) {
+    std::unique_ptr<Module> Src(unwrap(SrcRefs[I]));
+    assert(&Src->getContext() == &Dst->getContext() &&
+           "modules from different contexts can't be merged");
+    if (Linker::linkModules(*Dst, std::move(Src))) {
+      // The context's diagnostic handler has already reported the details.
+      LLVMRustSetLastError("");
+      return false;
+    }
+  }
+  return true;
+}
+
+// Captures linker diagnostics raised inside a worker's private context,
+// where the Rust-side handler (and its thread-local last-error slot) is not
+// reachable.
+static void collectLinkDiagnostic(const DiagnosticInfo &DI, void *Out) {
+  std::string &Err = *static_cast<std::string *>(Out);
+  SmallString<128> Msg;
+  raw_svector_ostream OS(Msg);
+  DiagnosticPrinterRawOStream Printer(OS);
+  DI.print(Printer);
+  if (!Err.empty())
+    Err.append("; ");
+  Err.append(Msg.begin(), Msg.end());
+}
+
+// Links a whole set of modules into the destination with a parallel tree
+// reduction instead of the linear chain LLVMRustLinkerAdd builds: modules
+// are merged in independent pairs, then the halves are merged, and only the
+// final result is linked into `L`'s module. Modules can never cross an
+// LLVMContext, so each pair is parsed into a worker-private context and the
+// merged module is re-serialized to bitcode for the next round. That
+// round-trip is the price of parallelism; it pays off when the inputs are
+// many and symbol-heavy (fat LTO over a large crate graph) and is why the
+// linear entry points remain the default for small inputs. Peak memory is
+// higher too: every round's intermediate buffers stay alive until the
+// reduction finishes.
+extern "C" bool
+LLVMRustLinkerAddParallel(RustLinker *L, const char *const *BCs,
+                          const size_t *Lens, size_t NumModules) {
+  std::vector<StringRef> Level;
+  Level.reserve(NumModules);
+  for (size_t I = 0; I < NumModules; I++)
+    Level.push_back(StringRef(BCs[I], Lens[I]));
+
+  // Owns every intermediate bitcode buffer; an odd module out is carried
+  // into the next round by reference, so buffers from earlier rounds can
+  // still be live.
+  std::vector<std::unique_ptr<SmallString<0>>> Storage;
+
+  while (Level.size() > 1) {
+    size_t NumPairs = Level.size() / 2;
+    std::vector<std::unique_ptr<SmallString<0>>> Merged(NumPairs);
+    std::vector<std::string> Errors(NumPairs);
+
+    WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
+    for (size_t I = 0; I < NumPairs; I++) {
+      Pool.async([&, I] {
+        LLVMContext Ctx;
+        Ctx.setDiagnosticHandlerCallBack(collectLinkDiagnostic, &Errors[I]);
+
+        auto Parse = [&](StringRef Buf) -> std::unique_ptr<Module> {
+          Expected<std::unique_ptr<Module>> ModOrError =
+              llvm::getLazyBitcodeModule(
+                  MemoryBufferRef(Buf, "lto-merge-input"), Ctx);
+          if (!ModOrError) {
+            Errors[I] = toString(ModOrError.takeError());
+            return nullptr;
+          }
+          return std::move(*ModOrError);
+        };
+
+        std::unique_ptr<Module> Dst = Parse(Level[2 * I]);
+        std::unique_ptr<Module> Src = Parse(Level[2 * I + 1]);
+        if (!Dst || !Src)
+          return;
+        if (Linker::linkModules(*Dst, std::move(Src))) {
+          if (Errors[I].empty())
+            Errors[I] = "failed to link modules";
+          return;
+        }
+        if (Error Err = Dst->materializeAll()) {
+          Errors[I] = toString(std::move(Err));
+          return;
+        }
+
+        Merged[I] = std::make_unique<SmallString<0>>();
+        raw_svector_ostream OS(*Merged[I]);
+        WriteBitcodeToFile(*Dst, OS);
+      });
+    }
+    Pool.wait();
+
+    std::string Joined;
+    for (const std::string &Err : Errors) {
+      if (Err.empty())
+        continue;
+      if (!Joined.empty())
+        Joined.append("; ");
+      Joined.append(Err);
+    }
+    if (!Joined.empty()) {
+      LLVMRustSetLastError(Joined.c_str());
+      return false;
+    }
+
+    std::vector<StringRef> NextLevel;
+    NextLevel.reserve(NumPairs + 1);
+    for (size_t I = 0; I < NumPairs; I++) {
+      NextLevel.push_back(StringRef(Merged[I]->data(), Merged[I]->size()));
+      Storage.push_back(std::move(Merged[I]));
+    }
+    if (Level.size() % 2 != 0)
+      NextLevel.push_back(Level.back());
+    Level = std::move(NextLevel);
+  }
+
+  if (Level.empty())
+    return true;
+  return LLVMRustLinkerAdd(L, const_cast<char *>(Level[0].data()),
+                           Level[0].size());
+}
+
+// Like LLVMRustLinkerAdd, but only links in definitions that resolve
+// references the destination module already has, so the bodies of
+// unreferenced globals are never materialized from the bitcode. The buffer
+// is not copied: lazy materialization finishes inside linkInModule, after
+// which the module holds no references into it, so `BC` only needs to stay
+// alive for the duration of this call.
+extern "C" bool
+LLVMRustLinkerAddOnlyNeeded(RustLinker *L, char *BC, size_t Len) {
+  std::unique_ptr<MemoryBuffer> Buf = MemoryBuffer::getMemBuffer(
+      StringRef(BC, Len), "", /*RequiresNullTerminator=*/false);
+
+  Expected<std::unique_ptr<Module>> SrcOrError =
+      llvm::getLazyBitcodeModule(Buf->getMemBufferRef(), L->Ctx);
+  if (!SrcOrError) {
+    LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
+    return false;
+  }
+
+  auto Src = std::move(*SrcOrError);
+
+  if (L->L.linkInModule(std::move(Src), Linker::Flags::LinkOnlyNeeded)) {
+    LLVMRustSetLastError("");
+    return false;
+  }
+  return true;
+}
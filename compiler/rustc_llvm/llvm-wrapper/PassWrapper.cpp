@@ -1,8 +1,25 @@
 #include <stdio.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include <mutex>
 #include <vector>
 #include <set>
 
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "LLVMWrapper.h"
 
 #include "llvm/Analysis/AliasAnalysis.h"
@@ -10,21 +27,42 @@
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/IR/AutoUpgrade.h"
+#include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/AssemblyAnnotationWriter.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCObjectWriter.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/IRObjectFile.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/CBindingWrapping.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/ThreadPool.h"
 #if LLVM_VERSION_GE(17, 0)
 #include "llvm/Support/VirtualFileSystem.h"
 #endif
 #include "llvm/Support/Host.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/FunctionImport.h"
@@ -38,6 +76,7 @@
 #include "llvm/Transforms/Instrumentation.h"
 #include "llvm/Transforms/Instrumentation/AddressSanitizer.h"
 #include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Transforms/Instrumentation/GCOVProfiler.h"
 #include "llvm/Transforms/Instrumentation/InstrProfiling.h"
 #include "llvm/Transforms/Instrumentation/ThreadSanitizer.h"
@@ -49,6 +88,10 @@
 
 using namespace llvm;
 
+// Defined with the huge-page plumbing further down; used by the buffer
+// creation paths above it.
+static void adviseHugePages(const void *Ptr, size_t Len);
+
 typedef struct LLVMOpaquePass *LLVMPassRef;
 typedef struct LLVMOpaqueTargetMachine *LLVMTargetMachineRef;
 
@@ -61,6 +104,13 @@ extern "C" void LLVMTimeTraceProfilerInitialize() {
       /* ProcName */ "rustc");
 }
 
+// Like LLVMTimeTraceProfilerInitialize, but with the granularity (in
+// microseconds) under the caller's control. Granularity 0 records every
+// event and easily produces multi-gigabyte traces on large crates.
+extern "C" void LLVMTimeTraceProfilerInitializeEx(unsigned Granularity) {
+  timeTraceProfilerInitialize(Granularity, /* ProcName */ "rustc");
+}
+
 extern "C" void LLVMTimeTraceProfilerFinishThread() {
   timeTraceProfilerFinishThread();
 }
@@ -74,6 +124,22 @@ extern "C" void LLVMTimeTraceProfilerFinish(const char* FileName) {
   timeTraceProfilerCleanup();
 }
 
+// Variant of LLVMTimeTraceProfilerFinish that hands the serialized trace
+// back in memory instead of writing it to disk, so rustc can compress it
+// and do the I/O off the critical path.
+extern "C" void LLVMTimeTraceProfilerFinishToBuffer(RustStringRef TraceOut) {
+  // timeTraceProfilerWrite wants a raw_pwrite_stream, which the RustString
+  // stream is not, so serialize into a local buffer and copy over.
+  SmallString<0> Trace;
+  raw_svector_ostream OS(Trace);
+
+  timeTraceProfilerWrite(OS);
+  timeTraceProfilerCleanup();
+
+  RawRustStringOstream TraceOS(TraceOut);
+  TraceOS << Trace;
+}
+
 #ifdef LLVM_COMPONENT_X86
 #define SUBTARGET_X86 SUBTARGET(X86)
 #else
@@ -176,11 +242,71 @@ extern "C" void LLVMTimeTraceProfilerFinish(const char* FileName) {
 GEN_SUBTARGETS
 #undef SUBTARGET
 
+// Feature queries go through `MCSubtargetInfo::checkFeatures`, which
+// allocates a SubtargetFeatures, splits the query string and binary-searches
+// the KV table for every call. rustc asks about the same subtarget many
+// times (once per `#[cfg(target_feature)]`-relevant feature), so we index
+// each subtarget's enabled-feature set into a hash map on first use and
+// answer subsequent queries with a single lookup. The tables can't be
+// perfect-hashed at compile time - they are data in whatever LLVM build we
+// link against - so a once-per-subtarget hashed index is the next best
+// thing. The cached feature bits are revalidated on every hit in case a
+// TargetMachine is freed and another reuses its address.
+//
+// The feature table is only reachable on rustc's LLVM fork (like the
+// enumeration entry points below); against stock LLVM the queries fall
+// back to checkFeatures.
+#ifdef LLVM_RUSTLLVM
+static struct {
+  std::mutex Lock;
+  DenseMap<const MCSubtargetInfo *,
+           std::unique_ptr<std::pair<FeatureBitset, StringMap<bool>>>>
+      Maps;
+} FeatureQueryCache;
+
+static const StringMap<bool> &getFeatureQueryMap(const MCSubtargetInfo *MCInfo) {
+  std::lock_guard<std::mutex> Guard(FeatureQueryCache.Lock);
+  auto &Slot = FeatureQueryCache.Maps[MCInfo];
+  if (!Slot || Slot->first != MCInfo->getFeatureBits()) {
+    Slot = std::make_unique<std::pair<FeatureBitset, StringMap<bool>>>();
+    Slot->first = MCInfo->getFeatureBits();
+    for (const SubtargetFeatureKV &Feat : MCInfo->getFeatureTable())
+      Slot->second[Feat.Key] = Slot->first[Feat.Value];
+  }
+  return Slot->second;
+}
+#endif
+
 extern "C" bool LLVMRustHasFeature(LLVMTargetMachineRef TM,
                                    const char *Feature) {
   TargetMachine *Target = unwrap(TM);
   const MCSubtargetInfo *MCInfo = Target->getMCSubtargetInfo();
+#ifdef LLVM_RUSTLLVM
+  return getFeatureQueryMap(MCInfo).lookup(Feature);
+#else
   return MCInfo->checkFeatures(std::string("+") + Feature);
+#endif
+}
+
+// Batch version of `LLVMRustHasFeature`: true iff every listed feature is
+// enabled. One FFI round trip and one pass over the hashed index instead of
+// a call per feature.
+extern "C" bool LLVMRustHasFeatures(LLVMTargetMachineRef TM,
+                                    const char *const *Features,
+                                    size_t NumFeatures) {
+  TargetMachine *Target = unwrap(TM);
+  const MCSubtargetInfo *MCInfo = Target->getMCSubtargetInfo();
+#ifdef LLVM_RUSTLLVM
+  const StringMap<bool> &Map = getFeatureQueryMap(MCInfo);
+  for (size_t I = 0; I < NumFeatures; I++)
+    if (!Map.lookup(Features[I]))
+      return false;
+#else
+  for (size_t I = 0; I < NumFeatures; I++)
+    if (!MCInfo->checkFeatures(std::string("+") + Features[I]))
+      return false;
+#endif
+  return true;
 }
 
 enum class LLVMRustCodeModel {
@@ -346,6 +472,39 @@ extern "C" void LLVMRustPrintTargetCPUs(LLVMTargetMachineRef TM, const char* Tar
   }
 }
 
+// Structured counterpart of LLVMRustPrintTargetCPUs: writes the CPU table
+// into `StringOut` as NUL-terminated strings, so tooling can enumerate the
+// supported CPUs without scraping stdout. The format is: the host CPU name
+// (empty when the host and target architectures differ, matching the
+// "native" suppression above), then the default target CPU, then one entry
+// per supported CPU.
+extern "C" void LLVMRustGetTargetCPUsPacked(LLVMTargetMachineRef TM,
+                                            const char *TargetCPU,
+                                            RustStringRef StringOut) {
+  const TargetMachine *Target = unwrap(TM);
+  const MCSubtargetInfo *MCInfo = Target->getMCSubtargetInfo();
+  const Triple::ArchType HostArch = Triple(sys::getDefaultTargetTriple()).getArch();
+  const Triple::ArchType TargetArch = Target->getTargetTriple().getArch();
+
+#if LLVM_VERSION_GE(17, 0)
+  const ArrayRef<SubtargetSubTypeKV> CPUTable = MCInfo->getAllProcessorDescriptions();
+#elif defined(LLVM_RUSTLLVM)
+  const ArrayRef<SubtargetSubTypeKV> CPUTable = MCInfo->getCPUTable();
+#else
+  SubtargetSubTypeKV TargetCPUKV = { TargetCPU, {{}}, {{}} };
+  const ArrayRef<SubtargetSubTypeKV> CPUTable = TargetCPUKV;
+#endif
+
+  RawRustStringOstream OS(StringOut);
+  if (HostArch == TargetArch) {
+    OS << sys::getHostCPUName();
+  }
+  OS << '\0' << TargetCPU << '\0';
+  for (auto &CPU : CPUTable) {
+    OS << CPU.Key << '\0';
+  }
+}
+
 extern "C" size_t LLVMRustGetTargetFeaturesCount(LLVMTargetMachineRef TM) {
 #ifdef LLVM_RUSTLLVM
   const TargetMachine *Target = unwrap(TM);
@@ -369,12 +528,59 @@ extern "C" void LLVMRustGetTargetFeature(LLVMTargetMachineRef TM, size_t Index,
 #endif
 }
 
+// Writes the whole feature table into `StringOut` in one call instead of one
+// FFI round trip per index. Each entry is `<state><key>\0<desc>\0` where
+// `<state>` is '+' if the feature is enabled on this machine and '-'
+// otherwise; hundreds of features exist for x86 and this sits on rustc's
+// startup path.
+extern "C" void LLVMRustGetTargetFeaturesPacked(LLVMTargetMachineRef TM,
+                                                RustStringRef StringOut) {
+#ifdef LLVM_RUSTLLVM
+  const TargetMachine *Target = unwrap(TM);
+  const MCSubtargetInfo *MCInfo = Target->getMCSubtargetInfo();
+  const FeatureBitset &Bits = MCInfo->getFeatureBits();
+  RawRustStringOstream OS(StringOut);
+  for (const SubtargetFeatureKV &Feat : MCInfo->getFeatureTable()) {
+    OS << ((Feat.Value & Bits).any() ? '+' : '-') << Feat.Key << '\0'
+       << Feat.Desc << '\0';
+  }
+#endif
+}
+
 extern "C" const char* LLVMRustGetHostCPUName(size_t *len) {
   StringRef Name = sys::getHostCPUName();
   *len = Name.size();
   return Name.data();
 }
 
+// rustc creates one TargetMachine per codegen unit, almost always with
+// identical arguments. Creation isn't free (triple normalization, target
+// registry lookup, TargetOptions construction), so cache that setup work
+// per distinct argument tuple. Only the recipe is shared, never a machine:
+// codegen units run on parallel threads and TargetMachines aren't
+// thread-safe to use concurrently (see cloneTargetMachine below), so every
+// call still gets its own instance, built from the cached recipe.
+struct RustTargetMachineCache {
+  std::mutex Lock;
+  struct Recipe {
+    const llvm::Target *TheTarget;
+    std::string Triple;
+    std::string CPU;
+    std::string Feature;
+    TargetOptions Options;
+    Reloc::Model RM;
+    LLVMRustCodeModel CM;
+    CodeGenOpt::Level OptLevel;
+  };
+  // Key is the concatenation of all creation arguments.
+  StringMap<Recipe> Recipes;
+};
+
+static RustTargetMachineCache &getTargetMachineCache() {
+  static RustTargetMachineCache Cache;
+  return Cache;
+}
+
 extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
     const char *TripleStr, const char *CPU, const char *Feature,
     const char *ABIStr, LLVMRustCodeModel RustCM, LLVMRustRelocModel RustReloc,
@@ -395,6 +601,40 @@ extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
   auto RM = fromRust(RustReloc);
   auto CM = fromRust(RustCM);
 
+  // Build the cache key from the raw arguments so that a cache hit skips all
+  // of the construction work below, not just `createTargetMachine`.
+  std::string Key;
+  {
+    raw_string_ostream KeyOS(Key);
+    KeyOS << TripleStr << '\0' << CPU << '\0' << Feature << '\0' << ABIStr
+          << '\0' << (SplitDwarfFile ? SplitDwarfFile : "") << '\0'
+          << static_cast<int>(RustCM) << ',' << static_cast<int>(RustReloc)
+          << ',' << static_cast<int>(RustOptLevel) << ',' << UseSoftFloat
+          << FunctionSections << DataSections << UniqueSectionNames
+          << TrapUnreachable << Singlethread << AsmComments
+          << EmitStackSizeSection << RelaxELFRelocations << UseInitArray
+          << ForceEmulatedTls;
+  }
+
+  auto &Cache = getTargetMachineCache();
+  {
+    // Create the machine outside the lock; only the recipe copy needs it.
+    RustTargetMachineCache::Recipe Recipe;
+    bool Hit = false;
+    {
+      std::lock_guard<std::mutex> Guard(Cache.Lock);
+      auto Cached = Cache.Recipes.find(Key);
+      if (Cached != Cache.Recipes.end()) {
+        Recipe = Cached->second;
+        Hit = true;
+      }
+    }
+    if (Hit)
+      return wrap(Recipe.TheTarget->createTargetMachine(
+          Recipe.Triple, Recipe.CPU, Recipe.Feature, Recipe.Options, Recipe.RM,
+          fromRust(Recipe.CM), Recipe.OptLevel));
+  }
+
   std::string Error;
   Triple Trip(Triple::normalize(TripleStr));
   const llvm::Target *TheTarget =
@@ -447,11 +687,47 @@ extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
 
   TargetMachine *TM = TheTarget->createTargetMachine(
       Trip.getTriple(), CPU, Feature, Options, RM, CM, OptLevel);
+
+  {
+    std::lock_guard<std::mutex> Guard(Cache.Lock);
+    // A racing thread may have inserted the same key meanwhile; either
+    // recipe is equivalent.
+    Cache.Recipes[Key] = {TheTarget, Trip.getTriple(), CPU,
+                          Feature,   Options,          RM,
+                          RustCM,    OptLevel};
+  }
   return wrap(TM);
 }
 
-extern "C" void LLVMRustDisposeTargetMachine(LLVMTargetMachineRef TM) {
-  delete unwrap(TM);
+extern "C" void LLVMRustDisposeTargetMachine(LLVMTargetMachineRef TMR) {
+  delete unwrap(TMR);
+}
+
+// One immutable TargetLibraryInfoImpl per (triple, DisableSimplifyLibCalls),
+// shared by every pipeline of the session. Building one walks a
+// several-hundred-entry libfunc table (twice, with the disable flag set),
+// and the result depends only on the key, so there is no reason to redo it
+// per module. Entries live for the process lifetime; consumers copy from
+// them where LLVM's interfaces take ownership, which is much cheaper than
+// reconstruction.
+static struct {
+  std::mutex Lock;
+  StringMap<std::unique_ptr<TargetLibraryInfoImpl>> Infos;
+} LibraryInfoCache;
+
+static const TargetLibraryInfoImpl &
+getLibraryInfoFor(const Triple &TargetTriple, bool DisableSimplifyLibCalls) {
+  SmallString<64> Key(TargetTriple.str());
+  Key.push_back(DisableSimplifyLibCalls ? '1' : '0');
+
+  std::lock_guard<std::mutex> Guard(LibraryInfoCache.Lock);
+  auto &Slot = LibraryInfoCache.Infos[Key];
+  if (!Slot) {
+    Slot = std::make_unique<TargetLibraryInfoImpl>(TargetTriple);
+    if (DisableSimplifyLibCalls)
+      Slot->disableAllFunctions();
+  }
+  return *Slot;
 }
 
 // Unfortunately, the LLVM C API doesn't provide a way to create the
@@ -459,10 +735,8 @@ extern "C" void LLVMRustDisposeTargetMachine(LLVMTargetMachineRef TM) {
 extern "C" void LLVMRustAddLibraryInfo(LLVMPassManagerRef PMR, LLVMModuleRef M,
                                        bool DisableSimplifyLibCalls) {
   Triple TargetTriple(unwrap(M)->getTargetTriple());
-  TargetLibraryInfoImpl TLII(TargetTriple);
-  if (DisableSimplifyLibCalls)
-    TLII.disableAllFunctions();
-  unwrap(PMR)->add(new TargetLibraryInfoWrapperPass(TLII));
+  unwrap(PMR)->add(new TargetLibraryInfoWrapperPass(
+      getLibraryInfoFor(TargetTriple, DisableSimplifyLibCalls)));
 }
 
 extern "C" void LLVMRustSetLLVMOptions(int Argc, char **Argv) {
@@ -497,6 +771,7 @@ extern "C" LLVMRustResult
 LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
                         LLVMModuleRef M, const char *Path, const char *DwoPath,
                         LLVMRustFileType RustFileType) {
+  LLVM_RUST_TIME_ENTRY_POINT();
   llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
   auto FileType = fromRust(RustFileType);
 
@@ -535,6 +810,546 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
   return LLVMRustResult::Success;
 }
 
+// Reads the .stack_sizes section out of a just-emitted object file and
+// returns one packed record per function: `name_len:u64le, name bytes,
+// stack_size:u64le`. Built for targets compiled with EmitStackSizeSection,
+// this lets rustc surface the top stack consumers at compile time instead
+// of parsing every object after the build. Section entries are located via
+// their relocations: each entry is a function address (fixed up by a
+// relocation against the function symbol, so the symbol is read from the
+// relocation) followed by a ULEB128 stack size. Returns Failure and sets
+// the last error if the object can't be read; an object without a
+// .stack_sizes section yields an empty buffer.
+extern "C" LLVMRustResult LLVMRustCollectStackSizes(const char *ObjPath,
+                                                    RustStringRef Out) {
+  auto BufOr = MemoryBuffer::getFile(ObjPath, /*IsText=*/false,
+                                     /*RequiresNullTerminator=*/false);
+  if (std::error_code EC = BufOr.getError()) {
+    LLVMRustSetLastError((Twine(ObjPath) + ": " + EC.message()).str().c_str());
+    return LLVMRustResult::Failure;
+  }
+  auto ObjOr = object::ObjectFile::createObjectFile((*BufOr)->getMemBufferRef());
+  if (!ObjOr) {
+    LLVMRustSetLastError(toString(ObjOr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+  object::ObjectFile &Obj = **ObjOr;
+  unsigned PtrSize = Obj.getBytesInAddress();
+
+  RawRustStringOstream OS(Out);
+  // On ELF the relocations for .stack_sizes live in their own
+  // .rela.stack_sizes section - asking the data section for its relocations
+  // yields an empty range - so walk the relocation sections and match the
+  // section each one applies to, the way llvm-readobj's stack-sizes printer
+  // does.
+  for (const object::SectionRef &RelocSec : Obj.sections()) {
+    Expected<object::section_iterator> RelocatedOr =
+        RelocSec.getRelocatedSection();
+    if (!RelocatedOr) {
+      consumeError(RelocatedOr.takeError());
+      continue;
+    }
+    if (*RelocatedOr == Obj.section_end())
+      continue;
+    const object::SectionRef &Section = **RelocatedOr;
+    Expected<StringRef> NameOr = Section.getName();
+    if (!NameOr) {
+      consumeError(NameOr.takeError());
+      continue;
+    }
+    if (*NameOr != ".stack_sizes")
+      continue;
+    Expected<StringRef> ContentsOr = Section.getContents();
+    if (!ContentsOr) {
+      LLVMRustSetLastError(toString(ContentsOr.takeError()).c_str());
+      return LLVMRustResult::Failure;
+    }
+    StringRef Contents = *ContentsOr;
+
+    for (const object::RelocationRef &Reloc : RelocSec.relocations()) {
+      object::symbol_iterator Sym = Reloc.getSymbol();
+      if (Sym == Obj.symbol_end())
+        continue;
+      Expected<StringRef> SymNameOr = Sym->getName();
+      if (!SymNameOr) {
+        consumeError(SymNameOr.takeError());
+        continue;
+      }
+      // The relocation patches the entry's address field; the ULEB128
+      // stack size sits right behind it.
+      uint64_t SizeOffset = Reloc.getOffset() + PtrSize;
+      if (SizeOffset >= Contents.size())
+        continue;
+      unsigned N = 0;
+      uint64_t StackSize = decodeULEB128(
+          reinterpret_cast<const uint8_t *>(Contents.data()) + SizeOffset, &N,
+          reinterpret_cast<const uint8_t *>(Contents.end()), nullptr);
+
+      char Buf[8];
+      support::endian::write64le(Buf, SymNameOr->size());
+      OS.write(Buf, sizeof(Buf));
+      OS << *SymNameOr;
+      support::endian::write64le(Buf, StackSize);
+      OS.write(Buf, sizeof(Buf));
+    }
+  }
+  return LLVMRustResult::Success;
+}
+
+// The shared worker pool behind wrapperPoolSubmit (declared in
+// LLVMWrapper.h). One process-wide set of workers serves every parallel
+// wrapper feature, so wrapper parallelism and rustc's own codegen
+// scheduler can't multiply into oversubscription on many-core builders;
+// the three priority queues let codegen-blocking work overtake thin-link
+// batches, and both overtake background I/O.
+struct WrapperPoolState {
+  std::mutex Lock;
+  std::condition_variable WorkAvailable;
+  std::deque<std::packaged_task<void()>> Queues[3];
+  size_t ThreadCount = 0;
+  bool Started = false;
+};
+// Intentionally leaked: the workers are detached and sit in
+// WorkAvailable.wait() forever, so a static-duration pool would have its
+// destructor tear down a condition variable that still has waiters -
+// undefined behavior, and a hang on glibc, at every process exit. Idle
+// workers and their queue simply die with the process instead.
+static WrapperPoolState &WrapperPool = *new WrapperPoolState;
+
+static void wrapperPoolWorker() {
+  for (;;) {
+    std::packaged_task<void()> Task;
+    {
+      std::unique_lock<std::mutex> Guard(WrapperPool.Lock);
+      WrapperPool.WorkAvailable.wait(Guard, [] {
+        for (const auto &Q : WrapperPool.Queues)
+          if (!Q.empty())
+            return true;
+        return false;
+      });
+      for (auto &Q : WrapperPool.Queues)
+        if (!Q.empty()) {
+          Task = std::move(Q.front());
+          Q.pop_front();
+          break;
+        }
+    }
+    Task();
+  }
+}
+
+// Fixes the pool's thread count before any work has been submitted.
+// Returns false (and changes nothing) once workers are running: rustc
+// must configure the pool at startup, not mid-session.
+extern "C" bool LLVMRustConfigureThreadPool(size_t Threads) {
+  std::lock_guard<std::mutex> Guard(WrapperPool.Lock);
+  if (WrapperPool.Started)
+    return false;
+  WrapperPool.ThreadCount = Threads;
+  return true;
+}
+
+static void wrapperPoolStartLocked() {
+  if (WrapperPool.Started)
+    return;
+  if (!WrapperPool.ThreadCount)
+    WrapperPool.ThreadCount = hardware_concurrency().compute_thread_count();
+  for (size_t I = 0; I < WrapperPool.ThreadCount; I++)
+    std::thread(wrapperPoolWorker).detach();
+  WrapperPool.Started = true;
+}
+
+std::shared_future<void> wrapperPoolSubmit(LLVMRustJobPriority Priority,
+                                           std::function<void()> Job) {
+  std::packaged_task<void()> Task(std::move(Job));
+  std::shared_future<void> Done(Task.get_future());
+  {
+    std::lock_guard<std::mutex> Guard(WrapperPool.Lock);
+    wrapperPoolStartLocked();
+    WrapperPool.Queues[static_cast<int>(Priority)].push_back(std::move(Task));
+  }
+  WrapperPool.WorkAvailable.notify_one();
+  return Done;
+}
+
+size_t wrapperPoolConcurrency() {
+  std::lock_guard<std::mutex> Guard(WrapperPool.Lock);
+  if (!WrapperPool.ThreadCount)
+    WrapperPool.ThreadCount = hardware_concurrency().compute_thread_count();
+  return WrapperPool.ThreadCount;
+}
+
+// Background write-back for emit-path outputs. Everything the emit paths
+// produce - object code, split-DWARF bytes, the time-trace profile - is
+// finished in memory and only needs a write(2) to reach disk; draining it
+// inline serializes codegen behind I/O, so completed buffers are handed to
+// a writer thread instead. LLVMRustOutputWriterFlush is the session
+// barrier: it must be called before any queued output is consumed (i.e.
+// before linking) and reports every write failure.
+static struct {
+  std::mutex Lock;
+  std::vector<std::shared_future<void>> Pending;
+  std::vector<std::string> Errors;
+} OutputWriter;
+
+static void outputWriterEnqueue(std::string Path, SmallString<0> Bytes) {
+  // std::function requires a copyable callable, so the payload rides in a
+  // shared_ptr rather than a by-move capture.
+  auto Payload = std::make_shared<SmallString<0>>(std::move(Bytes));
+  auto Done = wrapperPoolSubmit(
+      LLVMRustJobPriority::BackgroundIO, [Path, Payload] {
+        std::error_code EC;
+        raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+        if (!EC) {
+          OS.write(Payload->data(), Payload->size());
+          OS.close();
+          EC = OS.error();
+          OS.clear_error();
+        }
+        if (EC) {
+          std::lock_guard<std::mutex> Guard(OutputWriter.Lock);
+          OutputWriter.Errors.push_back(Path + ": " + EC.message());
+        }
+      });
+  std::lock_guard<std::mutex> Guard(OutputWriter.Lock);
+  OutputWriter.Pending.push_back(std::move(Done));
+}
+
+// Waits for all queued output writes. Returns true if every write
+// succeeded; otherwise writes one error per line to `ErrorsOut` and
+// returns false.
+extern "C" bool LLVMRustOutputWriterFlush(RustStringRef ErrorsOut) {
+  std::vector<std::shared_future<void>> Pending;
+  {
+    std::lock_guard<std::mutex> Guard(OutputWriter.Lock);
+    Pending = std::move(OutputWriter.Pending);
+    OutputWriter.Pending.clear();
+  }
+  for (auto &Job : Pending)
+    Job.wait();
+
+  std::lock_guard<std::mutex> Guard(OutputWriter.Lock);
+  RawRustStringOstream OS(ErrorsOut);
+  for (const std::string &Error : OutputWriter.Errors)
+    OS << Error << '\n';
+  bool Ok = OutputWriter.Errors.empty();
+  OutputWriter.Errors.clear();
+  return Ok;
+}
+
+// Like LLVMRustWriteOutputFile, but when `DwoPath` is set the split-DWARF
+// bytes are buffered and written out on the background writer above, so the
+// caller can move on to the next module while debug bytes drain to disk.
+extern "C" LLVMRustResult LLVMRustWriteOutputFileAsyncDwo(
+    LLVMTargetMachineRef Target, LLVMPassManagerRef PMR, LLVMModuleRef M,
+    const char *Path, const char *DwoPath, LLVMRustFileType RustFileType) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  auto FileType = fromRust(RustFileType);
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  buffer_ostream BOS(OS);
+  if (DwoPath) {
+    SmallString<0> DwoBytes;
+    raw_svector_ostream DOS(DwoBytes);
+    unwrap(Target)->addPassesToEmitFile(*PM, BOS, &DOS, FileType, false);
+    PM->run(*unwrap(M));
+    outputWriterEnqueue(DwoPath, std::move(DwoBytes));
+  } else {
+    unwrap(Target)->addPassesToEmitFile(*PM, BOS, nullptr, FileType, false);
+    PM->run(*unwrap(M));
+  }
+
+  LLVMDisposePassManager(PMR);
+  return LLVMRustResult::Success;
+}
+
+// Fully asynchronous variant of LLVMRustWriteOutputFile: the object code
+// (and split-DWARF bytes, when requested) are captured in memory during
+// the pass-manager run and drain on the background writer, so the codegen
+// thread never blocks on disk. Write failures only surface at
+// LLVMRustOutputWriterFlush, which is why the synchronous entry points
+// stay the default when the caller needs the file immediately.
+extern "C" LLVMRustResult LLVMRustWriteOutputFileAsync(
+    LLVMTargetMachineRef Target, LLVMPassManagerRef PMR, LLVMModuleRef M,
+    const char *Path, const char *DwoPath, LLVMRustFileType RustFileType) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  auto FileType = fromRust(RustFileType);
+
+  SmallString<0> Bytes;
+  raw_svector_ostream OS(Bytes);
+  SmallString<0> DwoBytes;
+  raw_svector_ostream DOS(DwoBytes);
+  if (unwrap(Target)->addPassesToEmitFile(*PM, OS, DwoPath ? &DOS : nullptr,
+                                          FileType, false)) {
+    LLVMRustSetLastError("TargetMachine can't emit the requested file type");
+    return LLVMRustResult::Failure;
+  }
+  PM->run(*unwrap(M));
+
+  // The streams feeding the pass manager go out of scope after it does;
+  // see the stream-lifetime comment in `LLVMRustWriteOutputFile`.
+  LLVMDisposePassManager(PMR);
+
+  outputWriterEnqueue(Path, std::move(Bytes));
+  if (DwoPath)
+    outputWriterEnqueue(DwoPath, std::move(DwoBytes));
+  return LLVMRustResult::Success;
+}
+
+// Variant of LLVMTimeTraceProfilerFinish that serializes the trace in
+// memory and queues the file write on the background writer. Defined here
+// rather than next to the synchronous version so it can see the writer;
+// the barrier is LLVMRustOutputWriterFlush, as for async object output.
+extern "C" void LLVMTimeTraceProfilerFinishAsync(const char *FileName) {
+  SmallString<0> Trace;
+  raw_svector_ostream OS(Trace);
+  timeTraceProfilerWrite(OS);
+  timeTraceProfilerCleanup();
+  outputWriterEnqueue(FileName, std::move(Trace));
+}
+
+// Emits assembly and an object file from one backend run, for
+// --emit=asm,obj. The code generator drives a single MCStreamer and LLVM
+// has no supported tee, so the dual mode runs the expensive half of the
+// backend (ISel, regalloc, scheduling, AsmPrinter) once to produce the
+// assembly text, then runs the MC assembler over that text in memory to
+// produce the object - the assembler is a small fraction of backend time.
+// The object is the assembled form of exactly the assembly written to
+// `AsmPath`, which may differ in irrelevant encodings from what direct
+// object emission would pick.
+extern "C" LLVMRustResult
+LLVMRustWriteOutputFilesDual(LLVMTargetMachineRef Target,
+                             LLVMPassManagerRef PMR, LLVMModuleRef M,
+                             const char *AsmPath, const char *ObjPath) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  TargetMachine *TM = unwrap(Target);
+
+  SmallString<0> Asm;
+  {
+    raw_svector_ostream OS(Asm);
+    if (TM->addPassesToEmitFile(*PM, OS, nullptr, CGFT_AssemblyFile, false)) {
+      LLVMRustSetLastError("TargetMachine can't emit an assembly file");
+      return LLVMRustResult::Failure;
+    }
+    PM->run(*unwrap(M));
+    LLVMDisposePassManager(PMR);
+  }
+
+  // Write the assembly as soon as it exists: a late assembler failure must
+  // not take the requested .s output down with it.
+  std::error_code EC;
+  raw_fd_ostream AsmOS(AsmPath, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  AsmOS.write(Asm.data(), Asm.size());
+  AsmOS.close();
+  if (AsmOS.has_error()) {
+    LLVMRustSetLastError(AsmOS.error().message().c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  const llvm::Target &T = TM->getTarget();
+  const MCAsmInfo *MAI = TM->getMCAsmInfo();
+  const MCRegisterInfo *MRI = TM->getMCRegisterInfo();
+  const MCInstrInfo *MCII = TM->getMCInstrInfo();
+  const MCSubtargetInfo *STI = TM->getMCSubtargetInfo();
+  const MCTargetOptions &MCOptions = TM->Options.MCOptions;
+
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(
+      MemoryBuffer::getMemBuffer(StringRef(Asm.data(), Asm.size()), AsmPath,
+                                 /*RequiresNullTerminator=*/false),
+      SMLoc());
+
+  MCContext Ctx(TM->getTargetTriple(), MAI, MRI, STI, &SrcMgr, &MCOptions);
+  std::unique_ptr<MCObjectFileInfo> MOFI(T.createMCObjectFileInfo(
+      Ctx, TM->getRelocationModel() == Reloc::PIC_));
+  Ctx.setObjectFileInfo(MOFI.get());
+
+  raw_fd_ostream ObjOS(ObjPath, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+
+#if LLVM_VERSION_LT(15, 0)
+  std::unique_ptr<MCCodeEmitter> CE(T.createMCCodeEmitter(*MCII, *MRI, Ctx));
+#else
+  std::unique_ptr<MCCodeEmitter> CE(T.createMCCodeEmitter(*MCII, Ctx));
+#endif
+  std::unique_ptr<MCAsmBackend> MAB(
+      T.createMCAsmBackend(*STI, *MRI, MCOptions));
+  if (!CE || !MAB) {
+    LLVMRustSetLastError("target has no integrated assembler");
+    return LLVMRustResult::Failure;
+  }
+  std::unique_ptr<MCObjectWriter> OW = MAB->createObjectWriter(ObjOS);
+  std::unique_ptr<MCStreamer> Streamer(T.createMCObjectStreamer(
+      TM->getTargetTriple(), Ctx, std::move(MAB), std::move(OW), std::move(CE),
+      *STI, MCOptions.MCRelaxAll, MCOptions.MCIncrementalLinkerCompatible,
+      /*DWARFMustBeAtTheEnd=*/false));
+
+  std::unique_ptr<MCAsmParser> Parser(
+      createMCAsmParser(SrcMgr, Ctx, *Streamer, *MAI));
+  std::unique_ptr<MCTargetAsmParser> TAP(
+      T.createMCAsmParser(*STI, *Parser, *MCII, MCOptions));
+  if (!TAP) {
+    LLVMRustSetLastError("target has no assembly parser");
+    return LLVMRustResult::Failure;
+  }
+  Parser->setTargetParser(*TAP);
+  if (Parser->Run(/*NoInitialTextSection=*/false)) {
+    LLVMRustSetLastError("failed to assemble the emitted assembly");
+    return LLVMRustResult::Failure;
+  }
+  ObjOS.close();
+  if (ObjOS.has_error()) {
+    LLVMRustSetLastError(ObjOS.error().message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
+// Codegen output captured in memory instead of being written to a path.
+// Exposed to Rust through the same Ptr/Len/Free pattern as
+// `LLVMRustThinLTOBuffer`, so rlib construction can consume the object bytes
+// without a round trip through the filesystem.
+struct LLVMRustOutputBuffer {
+  SmallString<0> Data;
+};
+
+// In-memory variant of `LLVMRustWriteOutputFile`. Returns null and sets the
+// last error on failure.
+extern "C" LLVMRustOutputBuffer *
+LLVMRustWriteOutputBuffer(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
+                          LLVMModuleRef M, LLVMRustFileType RustFileType) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  auto FileType = fromRust(RustFileType);
+
+  auto Ret = std::make_unique<LLVMRustOutputBuffer>();
+  raw_svector_ostream OS(Ret->Data);
+  if (unwrap(Target)->addPassesToEmitFile(*PM, OS, nullptr, FileType, false)) {
+    LLVMRustSetLastError("TargetMachine can't emit the requested file type");
+    return nullptr;
+  }
+  PM->run(*unwrap(M));
+
+  // See the comment in `LLVMRustWriteOutputFile` about stream lifetimes: the
+  // pass manager holds a pointer to our stream, so it has to go first.
+  LLVMDisposePassManager(PMR);
+  return Ret.release();
+}
+
+extern "C" void LLVMRustOutputBufferFree(LLVMRustOutputBuffer *Buffer) {
+  delete Buffer;
+}
+
+extern "C" const void *
+LLVMRustOutputBufferPtr(const LLVMRustOutputBuffer *Buffer) {
+  return Buffer->Data.data();
+}
+
+extern "C" size_t LLVMRustOutputBufferLen(const LLVMRustOutputBuffer *Buffer) {
+  return Buffer->Data.size();
+}
+
+// A single (module, output path) job for `LLVMRustWriteOutputFiles` below.
+// `DwoPath` may be null when no split-DWARF output is requested for the module.
+struct LLVMRustOutputFile {
+  LLVMModuleRef M;
+  LLVMTargetMachineRef TM;
+  const char *Path;
+  const char *DwoPath;
+};
+
+// Emits one module, creating the codegen pass pipeline internally. This is the
+// worker for `LLVMRustWriteOutputFiles`; unlike `LLVMRustWriteOutputFile` it
+// doesn't take a caller-built `PassManager`, so the analysis and library-info
+// passes that rustc normally adds from the Rust side are added here instead.
+static LLVMRustResult
+EmitOutputFile(TargetMachine *Target, Module *M, const char *Path,
+               const char *DwoPath, CodeGenFileType FileType,
+               bool DisableSimplifyLibCalls, std::string &ErrorInfo) {
+  llvm::legacy::PassManager PM;
+  PM.add(createTargetTransformInfoWrapperPass(Target->getTargetIRAnalysis()));
+  PM.add(new TargetLibraryInfoWrapperPass(getLibraryInfoFor(
+      Triple(M->getTargetTriple()), DisableSimplifyLibCalls)));
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    ErrorInfo = EC.message();
+    return LLVMRustResult::Failure;
+  }
+
+  buffer_ostream BOS(OS);
+  if (DwoPath) {
+    raw_fd_ostream DOS(DwoPath, EC, sys::fs::OF_None);
+    if (EC) {
+      ErrorInfo = EC.message();
+      return LLVMRustResult::Failure;
+    }
+    buffer_ostream DBOS(DOS);
+    Target->addPassesToEmitFile(PM, BOS, &DBOS, FileType, false);
+    PM.run(*M);
+  } else {
+    Target->addPassesToEmitFile(PM, BOS, nullptr, FileType, false);
+    PM.run(*M);
+  }
+  return LLVMRustResult::Success;
+}
+
+// Batched version of `LLVMRustWriteOutputFile`: emits all modules on an
+// internal thread pool instead of bouncing back to Rust between modules. Each
+// module must come with its own `TargetMachine` as LLVM doesn't guarantee that
+// one machine can be driven from multiple threads at once.
+//
+// `NumThreads == 0` lets LLVM pick the hardware concurrency. On failure the
+// first error encountered is reported; the remaining jobs still run to
+// completion so no output file is left half-written.
+extern "C" LLVMRustResult
+LLVMRustWriteOutputFiles(const LLVMRustOutputFile *Files, size_t NumFiles,
+                         LLVMRustFileType RustFileType,
+                         bool DisableSimplifyLibCalls, size_t NumThreads) {
+  auto FileType = fromRust(RustFileType);
+
+  std::mutex ErrorMutex;
+  std::string FirstError;
+
+  // Deliberately a private pool rather than the shared one: `NumThreads` is
+  // part of this entry point's contract, and the shared pool's width is fixed
+  // at startup.
+  ThreadPool Pool(hardware_concurrency(static_cast<unsigned>(NumThreads)));
+  for (size_t I = 0; I < NumFiles; I++) {
+    Pool.async([&, I] {
+      const LLVMRustOutputFile &File = Files[I];
+      std::string ErrorInfo;
+      if (EmitOutputFile(unwrap(File.TM), unwrap(File.M), File.Path,
+                         File.DwoPath, FileType, DisableSimplifyLibCalls,
+                         ErrorInfo) == LLVMRustResult::Failure) {
+        std::lock_guard<std::mutex> Lock(ErrorMutex);
+        if (FirstError.empty())
+          FirstError = ErrorInfo;
+      }
+    });
+  }
+  Pool.wait();
+
+  if (!FirstError.empty()) {
+    LLVMRustSetLastError(FirstError.c_str());
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
 extern "C" typedef void (*LLVMRustSelfProfileBeforePassCallback)(void*, // LlvmSelfProfiler
                                                       const char*,      // pass name
                                                       const char*);     // IR name
@@ -553,16 +1368,37 @@ std::string LLVMRustwrappedIrGetName(const llvm::Any &WrappedIr) {
 }
 
 
+// Whether the self-profiler wants the name of the IR unit each pass runs on.
+// When event args are not recorded, building those strings is pure overhead,
+// so rustc can turn them off before optimizing.
+static std::atomic<bool> SelfProfileRecordIrNames(true);
+
+extern "C" void LLVMRustSelfProfileSetRecordIrNames(bool Enabled) {
+  SelfProfileRecordIrNames.store(Enabled, std::memory_order_relaxed);
+}
+
 void LLVMSelfProfileInitializeCallbacks(
     PassInstrumentationCallbacks& PIC, void* LlvmSelfProfiler,
     LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
     LLVMRustSelfProfileAfterPassCallback AfterPassCallback) {
-  PIC.registerBeforeNonSkippedPassCallback([LlvmSelfProfiler, BeforePassCallback](
-                                           StringRef Pass, llvm::Any Ir) {
-    std::string PassName = Pass.str();
-    std::string IrName = LLVMRustwrappedIrGetName(Ir);
-    BeforePassCallback(LlvmSelfProfiler, PassName.c_str(), IrName.c_str());
-  });
+  // The set of pass names is small and fixed, so intern each one on first
+  // sight instead of heap-allocating a fresh std::string per event; the
+  // interned keys are NUL-terminated and stable for the callbacks' lifetime.
+  // Shared between the pass and analysis callbacks below.
+  auto PassNames = std::make_shared<StringSet<>>();
+
+  auto BeforeEvent = [LlvmSelfProfiler, BeforePassCallback, PassNames](
+                         StringRef Pass, llvm::Any Ir) {
+    const char *PassName = PassNames->insert(Pass).first->getKeyData();
+    if (SelfProfileRecordIrNames.load(std::memory_order_relaxed)) {
+      std::string IrName = LLVMRustwrappedIrGetName(Ir);
+      BeforePassCallback(LlvmSelfProfiler, PassName, IrName.c_str());
+    } else {
+      BeforePassCallback(LlvmSelfProfiler, PassName, "");
+    }
+  };
+
+  PIC.registerBeforeNonSkippedPassCallback(BeforeEvent);
 
   PIC.registerAfterPassCallback(
       [LlvmSelfProfiler, AfterPassCallback](StringRef Pass, llvm::Any IR,
@@ -575,12 +1411,7 @@ void LLVMSelfProfileInitializeCallbacks(
         AfterPassCallback(LlvmSelfProfiler);
       });
 
-  PIC.registerBeforeAnalysisCallback([LlvmSelfProfiler, BeforePassCallback](
-                                         StringRef Pass, llvm::Any Ir) {
-    std::string PassName = Pass.str();
-    std::string IrName = LLVMRustwrappedIrGetName(Ir);
-    BeforePassCallback(LlvmSelfProfiler, PassName.c_str(), IrName.c_str());
-  });
+  PIC.registerBeforeAnalysisCallback(BeforeEvent);
 
   PIC.registerAfterAnalysisCallback(
       [LlvmSelfProfiler, AfterPassCallback](StringRef Pass, llvm::Any Ir) {
@@ -588,14 +1419,436 @@ void LLVMSelfProfileInitializeCallbacks(
       });
 }
 
-enum class LLVMRustOptStage {
-  PreLinkNoLTO,
-  PreLinkThinLTO,
-  PreLinkFatLTO,
+// A completed self-profile event. `PassName` is interned by the queue and
+// stable for its lifetime; `IrName` points into queue-owned storage that is
+// only valid for the duration of the flush callback. Timestamps are
+// monotonic nanoseconds relative to the queue's creation.
+struct LLVMRustSelfProfileEvent {
+  const char *PassNamePtr;
+  size_t PassNameLen;
+  const char *IrNamePtr;
+  size_t IrNameLen;
+  uint64_t StartNanos;
+  uint64_t DurationNanos;
+};
+
+extern "C" typedef void (*LLVMRustSelfProfileFlushEventsCallback)(
+    void *,                              // LlvmSelfProfiler
+    const LLVMRustSelfProfileEvent *,    // completed events
+    size_t);                             // number of events
+
+// Buffered channel for the self-profiler. The synchronous callbacks above
+// cross the FFI boundary twice per pass execution and take a Rust-side lock
+// each time; an -O3 module produces hundreds of thousands of such events.
+// In buffered mode the wrapper timestamps events itself, matches the
+// strictly nested before/after pairs on a stack, and hands completed events
+// to Rust in blocks. One queue serves one optimization pipeline, which LLVM
+// runs on a single thread, so the hot path is lock-free; events are flushed
+// in completion order and the consumer orders them by start timestamp.
+class SelfProfileEventQueue {
+  static const size_t BlockSize = 256;
+
+  void *LlvmSelfProfiler;
+  LLVMRustSelfProfileFlushEventsCallback FlushCallback;
+  std::chrono::steady_clock::time_point Origin;
+
+  struct Event {
+    const char *PassName;
+    size_t PassNameLen;
+    std::string IrName;
+    uint64_t StartNanos;
+    uint64_t DurationNanos;
+  };
+  std::vector<Event> Stack;
+  std::vector<Event> Completed;
+  StringSet<> PassNames;
+
+  uint64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - Origin)
+        .count();
+  }
+
+public:
+  SelfProfileEventQueue(void *LlvmSelfProfiler,
+                        LLVMRustSelfProfileFlushEventsCallback FlushCallback)
+      : LlvmSelfProfiler(LlvmSelfProfiler), FlushCallback(FlushCallback),
+        Origin(std::chrono::steady_clock::now()) {
+    Completed.reserve(BlockSize);
+  }
+
+  ~SelfProfileEventQueue() { flush(); }
+
+  void begin(StringRef Pass, llvm::Any Ir) {
+    Event E;
+    auto &PassName = *PassNames.insert(Pass).first;
+    E.PassName = PassName.getKeyData();
+    E.PassNameLen = PassName.getKeyLength();
+    if (SelfProfileRecordIrNames.load(std::memory_order_relaxed))
+      E.IrName = LLVMRustwrappedIrGetName(Ir);
+    E.StartNanos = now();
+    Stack.push_back(std::move(E));
+  }
+
+  void end() {
+    // The instrumentation guarantees after events pair with before events,
+    // but be defensive about a mismatch rather than popping an empty stack.
+    if (Stack.empty())
+      return;
+    Event E = std::move(Stack.back());
+    Stack.pop_back();
+    E.DurationNanos = now() - E.StartNanos;
+    Completed.push_back(std::move(E));
+    if (Completed.size() >= BlockSize)
+      flush();
+  }
+
+  void flush() {
+    if (Completed.empty())
+      return;
+    std::vector<LLVMRustSelfProfileEvent> Block;
+    Block.reserve(Completed.size());
+    for (const Event &E : Completed)
+      Block.push_back({E.PassName, E.PassNameLen, E.IrName.data(),
+                       E.IrName.size(), E.StartNanos, E.DurationNanos});
+    FlushCallback(LlvmSelfProfiler, Block.data(), Block.size());
+    Completed.clear();
+  }
+};
+
+static void LLVMSelfProfileInitializeBufferedCallbacks(
+    PassInstrumentationCallbacks &PIC,
+    std::shared_ptr<SelfProfileEventQueue> Queue) {
+  auto BeforeEvent = [Queue](StringRef Pass, llvm::Any Ir) {
+    Queue->begin(Pass, Ir);
+  };
+
+  PIC.registerBeforeNonSkippedPassCallback(BeforeEvent);
+
+  PIC.registerAfterPassCallback(
+      [Queue](StringRef Pass, llvm::Any IR,
+              const PreservedAnalyses &Preserved) { Queue->end(); });
+
+  PIC.registerAfterPassInvalidatedCallback(
+      [Queue](StringRef Pass, const PreservedAnalyses &Preserved) {
+        Queue->end();
+      });
+
+  PIC.registerBeforeAnalysisCallback(BeforeEvent);
+
+  PIC.registerAfterAnalysisCallback(
+      [Queue](StringRef Pass, llvm::Any Ir) { Queue->end(); });
+}
+
+// Aggregated timing of every run of one pass, inclusive of nested passes.
+struct LLVMRustPassTiming {
+  uint64_t Runs = 0;
+  uint64_t WallNanos = 0;
+  int64_t MallocDelta = 0;
+};
+
+// Records per-pass wall time and malloc-usage deltas through
+// `PassInstrumentationCallbacks`. Unlike `LLVMRustPrintPassTimings` this
+// produces machine-readable output instead of the legacy timer dump on
+// stderr, so the data can feed a telemetry pipeline without text parsing.
+struct LLVMRustPassTimingRecorder {
+  StringMap<LLVMRustPassTiming> Timings;
+  // Before/after pass events nest like a call stack, so a plain stack of
+  // (start wall time, start malloc usage) pairs is enough to match them up.
+  SmallVector<std::pair<std::chrono::steady_clock::time_point, size_t>, 8>
+      Stack;
+
+  void registerCallbacks(PassInstrumentationCallbacks &PIC) {
+    PIC.registerBeforeNonSkippedPassCallback([this](StringRef Pass,
+                                                    llvm::Any Ir) {
+      Stack.push_back(
+          {std::chrono::steady_clock::now(), sys::Process::GetMallocUsage()});
+    });
+    auto AfterPass = [this](StringRef Pass) {
+      if (Stack.empty())
+        return;
+      auto Start = Stack.pop_back_val();
+      LLVMRustPassTiming &T = Timings[Pass];
+      T.Runs += 1;
+      T.WallNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - Start.first)
+                         .count();
+      T.MallocDelta += static_cast<int64_t>(sys::Process::GetMallocUsage()) -
+                       static_cast<int64_t>(Start.second);
+    };
+    PIC.registerAfterPassCallback(
+        [AfterPass](StringRef Pass, llvm::Any Ir,
+                    const PreservedAnalyses &Preserved) { AfterPass(Pass); });
+    PIC.registerAfterPassInvalidatedCallback(
+        [AfterPass](StringRef Pass, const PreservedAnalyses &Preserved) {
+          AfterPass(Pass);
+        });
+  }
+};
+
+extern "C" typedef void (*LLVMRustPassWatchdogCallback)(
+    void *,               // handle rustc passed to the enable call
+    const char *, size_t, // pass name
+    const char *, size_t, // IR unit name
+    uint64_t,             // elapsed wall nanoseconds
+    int64_t);             // malloc-usage delta in bytes
+
+// Opt-in budget enforcement for individual pass runs. A pathological
+// function can make a single pass run for minutes, and nothing above the
+// pipeline notices until the whole job looks hung; this watchdog fires
+// `Callback` as soon as the running pass exceeds its wall budget, so rustc
+// can log the culprit, deprioritize the module, or abort it instead of
+// stalling the build.
+//
+// A dedicated watcher thread samples the innermost running pass - that is
+// the actionable name when something is stuck; adaptors that are slow only
+// in aggregate are the profiler's department. Budgets are also checked when
+// each pass finishes, which is where the malloc budget is enforced (an
+// allocation burst can't be observed mid-pass without hooking the
+// allocator) and where outer frames that ran long in aggregate get
+// reported. Each pass execution is reported at most once. The callback may
+// run on the watcher thread, concurrently with the pass it names, and must
+// not assume it holds the pipeline's thread.
+//
+// Pass begin/end takes a mutex here where the profile queues above go out
+// of their way to avoid one; the watchdog is opt-in and the lock is
+// uncontended except at the sampling interval, so that cost is accepted.
+class PassWatchdog {
+  struct Frame {
+    const char *PassName;
+    size_t PassNameLen;
+    std::string IrName;
+    std::chrono::steady_clock::time_point Start;
+    size_t StartMalloc;
+    bool Fired = false;
+  };
+
+  void *Handle;
+  LLVMRustPassWatchdogCallback Callback;
+  uint64_t WallBudgetNanos;
+  int64_t MallocBudgetBytes;
+
+  std::mutex Lock;
+  std::condition_variable Shutdown;
+  std::vector<Frame> Stack;
+  StringSet<> PassNames;
+  bool ShuttingDown = false;
+  std::thread Watcher;
+
+  void watch() {
+    // Sample at a fraction of the budget so an overrun is reported soon
+    // after it starts, but never busier than every 10ms.
+    auto Interval = std::chrono::nanoseconds(
+        std::max<uint64_t>(WallBudgetNanos / 4, 10000000));
+    std::unique_lock<std::mutex> Guard(Lock);
+    while (!ShuttingDown) {
+      Shutdown.wait_for(Guard, Interval);
+      if (ShuttingDown || Stack.empty())
+        continue;
+      Frame &F = Stack.back();
+      uint64_t Elapsed =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - F.Start)
+              .count();
+      if (F.Fired || Elapsed < WallBudgetNanos)
+        continue;
+      F.Fired = true;
+      // Copy what the callback needs and drop the lock while calling out,
+      // so a callback that blocks (logging, taking a Rust-side lock) can't
+      // stall the pipeline thread's begin/end.
+      const char *PassName = F.PassName;
+      size_t PassNameLen = F.PassNameLen;
+      std::string IrName = F.IrName;
+      int64_t MallocDelta =
+          static_cast<int64_t>(sys::Process::GetMallocUsage()) -
+          static_cast<int64_t>(F.StartMalloc);
+      Guard.unlock();
+      Callback(Handle, PassName, PassNameLen, IrName.data(), IrName.size(),
+               Elapsed, MallocDelta);
+      Guard.lock();
+    }
+  }
+
+public:
+  PassWatchdog(void *Handle, LLVMRustPassWatchdogCallback Callback,
+               uint64_t WallBudgetNanos, int64_t MallocBudgetBytes)
+      : Handle(Handle), Callback(Callback), WallBudgetNanos(WallBudgetNanos),
+        MallocBudgetBytes(MallocBudgetBytes) {
+    if (WallBudgetNanos)
+      Watcher = std::thread([this] { watch(); });
+  }
+
+  ~PassWatchdog() {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      ShuttingDown = true;
+    }
+    Shutdown.notify_one();
+    if (Watcher.joinable())
+      Watcher.join();
+  }
+
+  void begin(StringRef Pass, llvm::Any Ir) {
+    Frame F;
+    auto &PassName = *PassNames.insert(Pass).first;
+    F.PassName = PassName.getKeyData();
+    F.PassNameLen = PassName.getKeyLength();
+    // Always record the IR name: watchdog events are rare and naming the
+    // function is their entire point, so SelfProfileRecordIrNames doesn't
+    // apply here.
+    F.IrName = LLVMRustwrappedIrGetName(Ir);
+    F.Start = std::chrono::steady_clock::now();
+    F.StartMalloc = sys::Process::GetMallocUsage();
+    std::lock_guard<std::mutex> Guard(Lock);
+    Stack.push_back(std::move(F));
+  }
+
+  void end() {
+    Frame F;
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      if (Stack.empty())
+        return;
+      F = std::move(Stack.back());
+      Stack.pop_back();
+    }
+    if (F.Fired)
+      return;
+    uint64_t Elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - F.Start)
+                           .count();
+    int64_t MallocDelta =
+        static_cast<int64_t>(sys::Process::GetMallocUsage()) -
+        static_cast<int64_t>(F.StartMalloc);
+    if ((WallBudgetNanos && Elapsed >= WallBudgetNanos) ||
+        (MallocBudgetBytes && MallocDelta >= MallocBudgetBytes))
+      Callback(Handle, F.PassName, F.PassNameLen, F.IrName.data(),
+               F.IrName.size(), Elapsed, MallocDelta);
+  }
+
+  void registerCallbacks(PassInstrumentationCallbacks &PIC) {
+    PIC.registerBeforeNonSkippedPassCallback(
+        [this](StringRef Pass, llvm::Any Ir) { begin(Pass, Ir); });
+    PIC.registerAfterPassCallback(
+        [this](StringRef Pass, llvm::Any Ir,
+               const PreservedAnalyses &Preserved) { end(); });
+    PIC.registerAfterPassInvalidatedCallback(
+        [this](StringRef Pass, const PreservedAnalyses &Preserved) {
+          end();
+        });
+  }
+};
+
+// Appends a pipeline fragment parsed from -Zllvm-extra-passes to the
+// context's pass manager. Every context parses its own pass instances:
+// contexts run on parallel codegen threads and new-PM pass objects are not
+// guaranteed reentrant, so instances must never be shared between them.
+// What is shared is the validation verdict - a pipeline string that failed
+// to parse once is rejected from the cache instead of being re-tokenized by
+// every context that names it.
+static Error appendCachedPassPipeline(PassBuilder &PB, ModulePassManager &MPM,
+                                      StringRef Pipeline) {
+  static std::mutex CacheLock;
+  static StringMap<std::string> KnownBad;
+
+  {
+    std::lock_guard<std::mutex> Guard(CacheLock);
+    auto Cached = KnownBad.find(Pipeline);
+    if (Cached != KnownBad.end())
+      return createStringError(inconvertibleErrorCode(),
+                               Cached->second.c_str());
+  }
+
+  // Parse into a local fragment so a mid-pipeline error doesn't leave half
+  // the passes appended to `MPM`.
+  ModulePassManager Fragment;
+  if (Error Err = PB.parsePassPipeline(Fragment, Pipeline)) {
+    std::string Msg = toString(std::move(Err));
+    std::lock_guard<std::mutex> Guard(CacheLock);
+    KnownBad.try_emplace(Pipeline, Msg);
+    return createStringError(inconvertibleErrorCode(), Msg.c_str());
+  }
+  MPM.addPass(std::move(Fragment));
+  return Error::success();
+}
+
+enum class LLVMRustOptStage {
+  PreLinkNoLTO,
+  PreLinkThinLTO,
+  PreLinkFatLTO,
   ThinLTO,
   FatLTO,
 };
 
+#if LLVM_VERSION_GE(17, 0)
+// One shared mapping of the PGO profile for the whole session. The profile
+// passes open and decode their input themselves - there is no way to hand
+// them a parsed profile through PassBuilder - but on LLVM 17+ they go
+// through the filesystem PGOOptions carries, so an overlay can at least
+// serve every open of a multi-hundred-megabyte .profdata from a single
+// shared mapping instead of re-reading it once per module. Keyed by path
+// and mtime; a changed or unreadable file falls back to the real
+// filesystem, which keeps the error reporting in the passes.
+static struct {
+  std::mutex Lock;
+  std::string Path;
+  llvm::sys::TimePoint<> MTime;
+  IntrusiveRefCntPtr<vfs::FileSystem> Overlay;
+} ProfileFileSystemCache;
+
+static IntrusiveRefCntPtr<vfs::FileSystem>
+getSharedProfileFileSystem(IntrusiveRefCntPtr<vfs::FileSystem> Real,
+                           const char *ProfilePath) {
+  sys::fs::file_status Status;
+  if (sys::fs::status(ProfilePath, Status))
+    return Real;
+
+  std::lock_guard<std::mutex> Guard(ProfileFileSystemCache.Lock);
+  if (ProfileFileSystemCache.Overlay &&
+      ProfileFileSystemCache.Path == ProfilePath &&
+      ProfileFileSystemCache.MTime == Status.getLastModificationTime())
+    return ProfileFileSystemCache.Overlay;
+
+  auto BufOr = MemoryBuffer::getFile(ProfilePath, /*IsText=*/false,
+                                     /*RequiresNullTerminator=*/false);
+  if (!BufOr)
+    return Real;
+
+  auto InMem = makeIntrusiveRefCnt<vfs::InMemoryFileSystem>();
+  InMem->addFile(ProfilePath,
+                 sys::toTimeT(Status.getLastModificationTime()),
+                 std::move(*BufOr));
+  auto Overlay = makeIntrusiveRefCnt<vfs::OverlayFileSystem>(std::move(Real));
+  Overlay->pushOverlay(std::move(InMem));
+
+  ProfileFileSystemCache.Path = ProfilePath;
+  ProfileFileSystemCache.MTime = Status.getLastModificationTime();
+  ProfileFileSystemCache.Overlay = Overlay;
+  return Overlay;
+}
+#endif
+
+// Session-wide counter-lowering choices for coverage instrumentation,
+// read when an optimize context with InstrumentCoverage is created. The
+// defaults match the historical hardcoded behavior: atomic counter bumps
+// (cargo runs tests multi-threaded by default) and no counter promotion.
+// rustc knows when the instrumented artifact is single-threaded - fuzz
+// and replay harnesses - where plain increments are about twice as fast;
+// promotion hoists counter updates out of loops into registers and is
+// worth enabling with them.
+static struct {
+  std::atomic<bool> Atomic{true};
+  std::atomic<bool> CounterPromotion{false};
+} CoverageCounterOptions;
+
+extern "C" void LLVMRustSetCoverageCounterOptions(bool AtomicCounters,
+                                                  bool DoCounterPromotion) {
+  CoverageCounterOptions.Atomic.store(AtomicCounters,
+                                      std::memory_order_relaxed);
+  CoverageCounterOptions.CounterPromotion.store(DoCounterPromotion,
+                                                std::memory_order_relaxed);
+}
+
 struct LLVMRustSanitizerOptions {
   bool SanitizeAddress;
   bool SanitizeAddressRecover;
@@ -609,17 +1862,53 @@ struct LLVMRustSanitizerOptions {
   bool SanitizeKernelAddressRecover;
 };
 
-extern "C" LLVMRustResult
-LLVMRustOptimize(
-    LLVMModuleRef ModuleRef,
-    LLVMTargetMachineRef TMRef,
+// All of the state needed to run the optimization pipeline that does not
+// depend on the module being optimized: the pass instrumentation, the
+// `PassBuilder` and the fully built `ModulePassManager`. Building this is
+// what dominates `LLVMRustOptimize` for small codegen units, so it is split
+// out into an opaque handle that rustc creates once per (TargetMachine,
+// options) pair and reuses for every module of the session. The analysis
+// managers are *not* part of the context; they cache analyses keyed by IR
+// units and must be fresh for each module.
+struct LLVMRustOptimizeContext {
+  TargetMachine *TM;
+  // `PB` holds a pointer to `PIC`, and the `StandardInstrumentations`
+  // callbacks are registered into `PIC`, so declaration order matters here.
+  PassInstrumentationCallbacks PIC;
+  std::unique_ptr<StandardInstrumentations> SI;
+  // On LLVM 16+ `SI` is built lazily from the first module's LLVMContext
+  // and its callbacks stay registered in `PIC` for the context's lifetime,
+  // so every later module must come from the same LLVMContext; this records
+  // which one, and optimizeWithContext rejects modules that don't match.
+  LLVMContext *SIContext = nullptr;
+  const TargetLibraryInfoImpl *TLII = nullptr;
+  std::unique_ptr<PassBuilder> PB;
+  ModulePassManager MPM;
+  std::unique_ptr<LLVMRustPassTimingRecorder> PassTimings;
+  std::unique_ptr<PassWatchdog> Watchdog;
+  bool NeedThinLTOBufferPasses = false;
+  // Self-profile channel, kept so per-module memory deltas can be reported
+  // as synthetic events; null when the caller didn't pass a profiler.
+  void *LlvmSelfProfiler = nullptr;
+  LLVMRustSelfProfileBeforePassCallback BeforePassCallback = nullptr;
+  LLVMRustSelfProfileAfterPassCallback AfterPassCallback = nullptr;
+  bool ReportMemoryDeltas = false;
+  // Set instead of the synchronous channel above when the caller opted into
+  // block-flushed profiling; kept alive here because the PIC lambdas only
+  // hold shared references.
+  std::shared_ptr<SelfProfileEventQueue> BufferedProfile;
+};
+
+static LLVMRustOptimizeContext *createOptimizeContext(
+    TargetMachine *TM,
     LLVMRustPassBuilderOptLevel OptLevelRust,
     LLVMRustOptStage OptStage,
     bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
     bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
-    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    bool DisableSimplifyLibCalls,
     LLVMRustSanitizerOptions *SanitizerOptions,
     const char *PGOGenPath, const char *PGOUsePath,
+    const char *CSProfileGenPath, const char *CSProfileUsePath,
     bool InstrumentCoverage, const char *InstrProfileOutput,
     bool InstrumentGCOV,
     const char *PGOSampleUsePath, bool DebugInfoForProfiling,
@@ -628,11 +1917,10 @@ LLVMRustOptimize(
     LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
     const char *ExtraPasses, size_t ExtraPassesLen,
     const char *LLVMPlugins, size_t LLVMPluginsLen) {
-  Module *TheModule = unwrap(ModuleRef);
-  TargetMachine *TM = unwrap(TMRef);
+  auto Ctx = std::make_unique<LLVMRustOptimizeContext>();
+  Ctx->TM = TM;
   OptimizationLevel OptLevel = fromRust(OptLevelRust);
 
-
   PipelineTuningOptions PTO;
   PTO.LoopUnrolling = UnrollLoops;
   PTO.LoopInterleaving = UnrollLoops;
@@ -643,16 +1931,20 @@ LLVMRustOptimize(
   // FIXME: We may want to expose this as an option.
   bool DebugPassManager = false;
 
-  PassInstrumentationCallbacks PIC;
+  PassInstrumentationCallbacks &PIC = Ctx->PIC;
 #if LLVM_VERSION_LT(16, 0)
-  StandardInstrumentations SI(DebugPassManager);
-#else
-  StandardInstrumentations SI(TheModule->getContext(), DebugPassManager);
+  Ctx->SI = std::make_unique<StandardInstrumentations>(DebugPassManager);
+  Ctx->SI->registerCallbacks(PIC);
 #endif
-  SI.registerCallbacks(PIC);
+  // On LLVM 16+ StandardInstrumentations wants an LLVMContext, which we don't
+  // have until the first module arrives; it is created lazily in
+  // optimizeWithContext below.
 
   if (LlvmSelfProfiler){
     LLVMSelfProfileInitializeCallbacks(PIC,LlvmSelfProfiler,BeforePassCallback,AfterPassCallback);
+    Ctx->LlvmSelfProfiler = LlvmSelfProfiler;
+    Ctx->BeforePassCallback = BeforePassCallback;
+    Ctx->AfterPassCallback = AfterPassCallback;
   }
 
 #if LLVM_VERSION_LT(16, 0)
@@ -661,7 +1953,14 @@ LLVMRustOptimize(
   std::optional<PGOOptions> PGOOpt;
 #endif
 #if LLVM_VERSION_GE(17, 0)
-  auto FS = vfs::getRealFileSystem();
+  IntrusiveRefCntPtr<vfs::FileSystem> FS = vfs::getRealFileSystem();
+  // Serve the profile being consumed out of the session-shared mapping;
+  // every context (and thus every module optimization) opens it afresh.
+  if (const char *ProfileUsePath = PGOUsePath          ? PGOUsePath
+                                   : PGOSampleUsePath  ? PGOSampleUsePath
+                                   : CSProfileUsePath  ? CSProfileUsePath
+                                                       : nullptr)
+    FS = getSharedProfileFileSystem(std::move(FS), ProfileUsePath);
 #endif
   if (PGOGenPath) {
     assert(!PGOUsePath && !PGOSampleUsePath);
@@ -695,25 +1994,39 @@ LLVMRustOptimize(
                         DebugInfoForProfiling);
   }
 
-  PassBuilder PB(TM, PTO, PGOOpt, &PIC);
-  LoopAnalysisManager LAM;
-  FunctionAnalysisManager FAM;
-  CGSCCAnalysisManager CGAM;
-  ModuleAnalysisManager MAM;
-
-  FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+  // Context-sensitive PGO is a second round on top of the ordinary IR PGO:
+  // instrumentation is inserted after the profile-guided inlining decisions
+  // (usually combined with -C profile-use), and a CS profile is consumed
+  // through CSIRUse. This mirrors the wiring in clang's EmitAssemblyHelper.
+  if (CSProfileUsePath) {
+    assert(!CSProfileGenPath);
+    PGOOpt = PGOOptions(CSProfileUsePath, "", "",
+#if LLVM_VERSION_GE(17, 0)
+                        FS,
+#endif
+                        PGOOptions::IRUse, PGOOptions::CSIRUse,
+                        DebugInfoForProfiling);
+  } else if (CSProfileGenPath) {
+    if (PGOOpt) {
+      PGOOpt->CSAction = PGOOptions::CSIRInstr;
+      PGOOpt->CSProfileGenFile = CSProfileGenPath;
+    } else {
+      PGOOpt = PGOOptions("", CSProfileGenPath, "",
+#if LLVM_VERSION_GE(17, 0)
+                          FS,
+#endif
+                          PGOOptions::NoAction, PGOOptions::CSIRInstr,
+                          DebugInfoForProfiling);
+    }
+  }
 
-  Triple TargetTriple(TheModule->getTargetTriple());
-  std::unique_ptr<TargetLibraryInfoImpl> TLII(new TargetLibraryInfoImpl(TargetTriple));
-  if (DisableSimplifyLibCalls)
-    TLII->disableAllFunctions();
-  FAM.registerPass([&] { return TargetLibraryAnalysis(*TLII); });
+  Ctx->PB = std::make_unique<PassBuilder>(TM, PTO, PGOOpt, &PIC);
+  PassBuilder &PB = *Ctx->PB;
 
-  PB.registerModuleAnalyses(MAM);
-  PB.registerCGSCCAnalyses(CGAM);
-  PB.registerFunctionAnalyses(FAM);
-  PB.registerLoopAnalyses(LAM);
-  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  // All modules of a session share the target, so the library info comes
+  // from the session cache keyed by the TargetMachine's triple instead of
+  // being rebuilt per module (or even per context).
+  Ctx->TLII = &getLibraryInfoFor(TM->getTargetTriple(), DisableSimplifyLibCalls);
 
   // We manually collect pipeline callbacks so we can apply them at O0, where the
   // PassBuilder does not create a pipeline.
@@ -745,71 +2058,80 @@ LLVMRustOptimize(
         if (InstrProfileOutput) {
           Options.InstrProfileOutput = InstrProfileOutput;
         }
-        // cargo run tests in multhreading mode by default
-        // so use atomics for coverage counters
-        Options.Atomic = true;
+        // Defaults are atomic bumps and no promotion; see
+        // LLVMRustSetCoverageCounterOptions.
+        Options.Atomic =
+            CoverageCounterOptions.Atomic.load(std::memory_order_relaxed);
+        Options.DoCounterPromotion = CoverageCounterOptions.CounterPromotion
+                                         .load(std::memory_order_relaxed);
         MPM.addPass(InstrProfiling(Options, false));
       }
     );
   }
 
   if (SanitizerOptions) {
-    if (SanitizerOptions->SanitizeMemory) {
-      MemorySanitizerOptions Options(
-          SanitizerOptions->SanitizeMemoryTrackOrigins,
-          SanitizerOptions->SanitizeMemoryRecover,
-          /*CompileKernel=*/false,
-          /*EagerChecks=*/true);
+    // All enabled sanitizers are registered through one callback so their
+    // function-level instrumenters can share a single FunctionPassManager
+    // adaptor (one module walk) where LLVM provides them as function
+    // passes. Fusing deeper than that - a single per-instruction dispatch
+    // across sanitizers - isn't possible from here: each sanitizer is a
+    // self-contained LLVM pass whose instrumentation logic has no
+    // per-instruction hooks.
+    LLVMRustSanitizerOptions SanOpts = *SanitizerOptions;
+    if (SanOpts.SanitizeMemory || SanOpts.SanitizeThread ||
+        SanOpts.SanitizeAddress || SanOpts.SanitizeKernelAddress ||
+        SanOpts.SanitizeHWAddress) {
       OptimizerLastEPCallbacks.push_back(
-        [Options](ModulePassManager &MPM, OptimizationLevel Level) {
+        [SanOpts](ModulePassManager &MPM, OptimizationLevel Level) {
+          FunctionPassManager FPM;
+
+          if (SanOpts.SanitizeMemory) {
+            MemorySanitizerOptions Options(
+                SanOpts.SanitizeMemoryTrackOrigins,
+                SanOpts.SanitizeMemoryRecover,
+                /*CompileKernel=*/false,
+                /*EagerChecks=*/true);
 #if LLVM_VERSION_LT(16, 0)
-          MPM.addPass(ModuleMemorySanitizerPass(Options));
-          MPM.addPass(createModuleToFunctionPassAdaptor(MemorySanitizerPass(Options)));
+            MPM.addPass(ModuleMemorySanitizerPass(Options));
+            FPM.addPass(MemorySanitizerPass(Options));
 #else
-          MPM.addPass(MemorySanitizerPass(Options));
+            MPM.addPass(MemorySanitizerPass(Options));
 #endif
-        }
-      );
-    }
+          }
 
-    if (SanitizerOptions->SanitizeThread) {
-      OptimizerLastEPCallbacks.push_back(
-        [](ModulePassManager &MPM, OptimizationLevel Level) {
-          MPM.addPass(ModuleThreadSanitizerPass());
-          MPM.addPass(createModuleToFunctionPassAdaptor(ThreadSanitizerPass()));
-        }
-      );
-    }
+          if (SanOpts.SanitizeThread) {
+            MPM.addPass(ModuleThreadSanitizerPass());
+            FPM.addPass(ThreadSanitizerPass());
+          }
 
-    if (SanitizerOptions->SanitizeAddress || SanitizerOptions->SanitizeKernelAddress) {
-      OptimizerLastEPCallbacks.push_back(
-        [SanitizerOptions](ModulePassManager &MPM, OptimizationLevel Level) {
-          auto CompileKernel = SanitizerOptions->SanitizeKernelAddress;
+          if (SanOpts.SanitizeAddress || SanOpts.SanitizeKernelAddress) {
+            auto CompileKernel = SanOpts.SanitizeKernelAddress;
 #if LLVM_VERSION_LT(15, 0)
-          MPM.addPass(RequireAnalysisPass<ASanGlobalsMetadataAnalysis, Module>());
+            MPM.addPass(RequireAnalysisPass<ASanGlobalsMetadataAnalysis, Module>());
 #endif
-          AddressSanitizerOptions opts = AddressSanitizerOptions{
-            CompileKernel,
-            SanitizerOptions->SanitizeAddressRecover
-              || SanitizerOptions->SanitizeKernelAddressRecover,
-            /*UseAfterScope=*/true,
-            AsanDetectStackUseAfterReturnMode::Runtime,
-          };
+            AddressSanitizerOptions opts = AddressSanitizerOptions{
+              CompileKernel,
+              SanOpts.SanitizeAddressRecover
+                || SanOpts.SanitizeKernelAddressRecover,
+              /*UseAfterScope=*/true,
+              AsanDetectStackUseAfterReturnMode::Runtime,
+            };
 #if LLVM_VERSION_LT(16, 0)
-          MPM.addPass(ModuleAddressSanitizerPass(opts));
+            MPM.addPass(ModuleAddressSanitizerPass(opts));
 #else
-          MPM.addPass(AddressSanitizerPass(opts));
+            MPM.addPass(AddressSanitizerPass(opts));
 #endif
-        }
-      );
-    }
-    if (SanitizerOptions->SanitizeHWAddress) {
-      OptimizerLastEPCallbacks.push_back(
-        [SanitizerOptions](ModulePassManager &MPM, OptimizationLevel Level) {
-          HWAddressSanitizerOptions opts(
-              /*CompileKernel=*/false, SanitizerOptions->SanitizeHWAddressRecover,
-              /*DisableOptimization=*/false);
-          MPM.addPass(HWAddressSanitizerPass(opts));
+          }
+
+          if (SanOpts.SanitizeHWAddress) {
+            HWAddressSanitizerOptions opts(
+                /*CompileKernel=*/false, SanOpts.SanitizeHWAddressRecover,
+                /*DisableOptimization=*/false);
+            MPM.addPass(HWAddressSanitizerPass(opts));
+          }
+
+          if (!FPM.isEmpty())
+            MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
         }
       );
     }
@@ -823,14 +2145,15 @@ LLVMRustOptimize(
       auto Plugin = PassPlugin::Load(PluginPath.str());
       if (!Plugin) {
         LLVMRustSetLastError(("Failed to load pass plugin" + PluginPath.str()).c_str());
-        return LLVMRustResult::Failure;
+        return nullptr;
       }
       Plugin->registerPassBuilderCallbacks(PB);
     }
   }
 
-  ModulePassManager MPM;
-  bool NeedThinLTOBufferPasses = UseThinLTOBuffers;
+  ModulePassManager &MPM = Ctx->MPM;
+  bool &NeedThinLTOBufferPasses = Ctx->NeedThinLTOBufferPasses;
+  NeedThinLTOBufferPasses = UseThinLTOBuffers;
   if (!NoPrepopulatePasses) {
     // The pre-link pipelines don't support O0 and require using buildO0DefaultPipeline() instead.
     // At the same time, the LTO pipelines do support O0 and using them is required.
@@ -890,10 +2213,11 @@ LLVMRustOptimize(
   }
 
   if (ExtraPassesLen) {
-    if (auto Err = PB.parsePassPipeline(MPM, StringRef(ExtraPasses, ExtraPassesLen))) {
+    if (auto Err = appendCachedPassPipeline(
+            PB, MPM, StringRef(ExtraPasses, ExtraPassesLen))) {
       std::string ErrMsg = toString(std::move(Err));
       LLVMRustSetLastError(ErrMsg.c_str());
-      return LLVMRustResult::Failure;
+      return nullptr;
     }
   }
 
@@ -902,14 +2226,368 @@ LLVMRustOptimize(
     MPM.addPass(NameAnonGlobalPass());
   }
 
-  // Upgrade all calls to old intrinsics first.
-  for (Module::iterator I = TheModule->begin(), E = TheModule->end(); I != E;)
-    UpgradeCallsToIntrinsic(&*I++); // must be post-increment, as we remove
+  return Ctx.release();
+}
+
+// Returns the process's peak resident set size in bytes, or 0 when the
+// platform doesn't expose it; LLVM's Process interface has no peak-RSS
+// accessor, so this goes to getrusage directly.
+static uint64_t getPeakRSSBytes() {
+#if !defined(_WIN32)
+  struct rusage RU;
+  if (getrusage(RUSAGE_SELF, &RU) != 0)
+    return 0;
+#if defined(__APPLE__)
+  // ru_maxrss is bytes on Darwin, kilobytes elsewhere.
+  return static_cast<uint64_t>(RU.ru_maxrss);
+#else
+  return static_cast<uint64_t>(RU.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// Runs the context's prebuilt pipeline over one module. Only the analysis
+// managers are per-module; everything else is reused from the context.
+static LLVMRustResult optimizeWithContext(LLVMRustOptimizeContext *Ctx,
+                                          Module *TheModule,
+                                          bool UpgradeIntrinsics) {
+  PassBuilder &PB = *Ctx->PB;
+
+#if LLVM_VERSION_GE(16, 0)
+  if (!Ctx->SI) {
+    // FIXME: We may want to expose this as an option.
+    bool DebugPassManager = false;
+    Ctx->SI = std::make_unique<StandardInstrumentations>(
+        TheModule->getContext(), DebugPassManager);
+    Ctx->SI->registerCallbacks(Ctx->PIC);
+    Ctx->SIContext = &TheModule->getContext();
+  } else if (Ctx->SIContext != &TheModule->getContext()) {
+    // The instrumentation can't be re-registered for a new LLVMContext
+    // (PassInstrumentationCallbacks has no unregister), and letting it run
+    // with a reference to a freed context is worse. Callers that reuse an
+    // optimize context across modules must put those modules in one
+    // LLVMContext.
+    LLVMRustSetLastError("all modules optimized through one context must "
+                         "share an LLVMContext");
+    return LLVMRustResult::Failure;
+  }
+#endif
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+  FAM.registerPass([&] { return TargetLibraryAnalysis(*Ctx->TLII); });
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // Upgrade all calls to old intrinsics first. Only modules deserialized
+  // from old bitcode can contain stale intrinsics, so callers skip this for
+  // freshly generated modules. The walk stays serial even when it runs:
+  // UpgradeCallsToIntrinsic rewrites declarations in the module symbol
+  // table, which isn't safe to touch from several threads.
+  if (UpgradeIntrinsics)
+    for (Module::iterator I = TheModule->begin(), E = TheModule->end(); I != E;)
+      UpgradeCallsToIntrinsic(&*I++); // must be post-increment, as we remove
+
+  // When enabled, per-module memory deltas are surfaced as a synthetic
+  // self-profile event, so existing build telemetry can attribute a memory
+  // spike to the module that caused it without any new reporting channel.
+  bool SampleMemory = Ctx->ReportMemoryDeltas && Ctx->LlvmSelfProfiler;
+  uint64_t MallocBefore = SampleMemory ? sys::Process::GetMallocUsage() : 0;
+
+  Ctx->MPM.run(*TheModule, MAM);
+
+  if (SampleMemory) {
+    int64_t MallocDelta = static_cast<int64_t>(sys::Process::GetMallocUsage()) -
+                          static_cast<int64_t>(MallocBefore);
+    std::string Detail;
+    raw_string_ostream DetailOS(Detail);
+    DetailOS << TheModule->getModuleIdentifier()
+             << " malloc_delta_bytes=" << MallocDelta
+             << " peak_rss_bytes=" << getPeakRSSBytes();
+    DetailOS.flush();
+    Ctx->BeforePassCallback(Ctx->LlvmSelfProfiler, "LLVMRustModuleMemoryStats",
+                            Detail.c_str());
+    Ctx->AfterPassCallback(Ctx->LlvmSelfProfiler);
+  }
 
-  MPM.run(*TheModule, MAM);
   return LLVMRustResult::Success;
 }
 
+extern "C" LLVMRustOptimizeContext *LLVMRustOptimizeContextCreate(
+    LLVMTargetMachineRef TMRef,
+    LLVMRustPassBuilderOptLevel OptLevelRust,
+    LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
+    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    LLVMRustSanitizerOptions *SanitizerOptions,
+    const char *PGOGenPath, const char *PGOUsePath,
+    const char *CSProfileGenPath, const char *CSProfileUsePath,
+    bool InstrumentCoverage, const char *InstrProfileOutput,
+    bool InstrumentGCOV,
+    const char *PGOSampleUsePath, bool DebugInfoForProfiling,
+    void* LlvmSelfProfiler,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const char *ExtraPasses, size_t ExtraPassesLen,
+    const char *LLVMPlugins, size_t LLVMPluginsLen) {
+  return createOptimizeContext(
+      unwrap(TMRef), OptLevelRust, OptStage, NoPrepopulatePasses, VerifyIR,
+      UseThinLTOBuffers, MergeFunctions, UnrollLoops, SLPVectorize,
+      LoopVectorize, DisableSimplifyLibCalls, SanitizerOptions, PGOGenPath,
+      PGOUsePath, CSProfileGenPath, CSProfileUsePath, InstrumentCoverage,
+      InstrProfileOutput, InstrumentGCOV,
+      PGOSampleUsePath, DebugInfoForProfiling, LlvmSelfProfiler,
+      BeforePassCallback, AfterPassCallback, ExtraPasses, ExtraPassesLen,
+      LLVMPlugins, LLVMPluginsLen);
+}
+
+extern "C" LLVMRustResult
+LLVMRustOptimizeWithContext(LLVMRustOptimizeContext *Ctx, LLVMModuleRef M) {
+  return optimizeWithContext(Ctx, unwrap(M), /*UpgradeIntrinsics=*/true);
+}
+
+// Like LLVMRustOptimizeWithContext, but lets the caller state whether the
+// module may contain calls to legacy intrinsics. Modules coming straight
+// out of rustc's codegen never do - only deserialized old bitcode can - so
+// they pass false and skip the whole-module upgrade walk.
+extern "C" LLVMRustResult
+LLVMRustOptimizeWithContextEx(LLVMRustOptimizeContext *Ctx, LLVMModuleRef M,
+                              bool MayHaveLegacyIntrinsics) {
+  return optimizeWithContext(Ctx, unwrap(M), MayHaveLegacyIntrinsics);
+}
+
+extern "C" void LLVMRustOptimizeContextDispose(LLVMRustOptimizeContext *Ctx) {
+  delete Ctx;
+}
+
+// Optimizes a module and emits machine code for it in one call, so the
+// optimized IR goes straight into ISel instead of taking an FFI round trip
+// between LLVMRustOptimize and LLVMRustWriteOutputFile. The codegen pass
+// manager is built internally from the context's target machine; like the
+// split path, it must be rebuilt per module because addPassesToEmitFile
+// captures the output streams.
+extern "C" LLVMRustResult LLVMRustOptimizeAndEmitWithContext(
+    LLVMRustOptimizeContext *Ctx, LLVMModuleRef M,
+    bool MayHaveLegacyIntrinsics, const char *Path, const char *DwoPath,
+    LLVMRustFileType RustFileType) {
+  if (optimizeWithContext(Ctx, unwrap(M), MayHaveLegacyIntrinsics) !=
+      LLVMRustResult::Success)
+    return LLVMRustResult::Failure;
+
+  auto FileType = fromRust(RustFileType);
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  llvm::legacy::PassManager PM;
+  buffer_ostream BOS(OS);
+  if (DwoPath) {
+    raw_fd_ostream DOS(DwoPath, EC, sys::fs::OF_None);
+    if (EC) {
+      LLVMRustSetLastError(EC.message().c_str());
+      return LLVMRustResult::Failure;
+    }
+    buffer_ostream DBOS(DOS);
+    Ctx->TM->addPassesToEmitFile(PM, BOS, &DBOS, FileType, false);
+    PM.run(*unwrap(M));
+  } else {
+    Ctx->TM->addPassesToEmitFile(PM, BOS, nullptr, FileType, false);
+    PM.run(*unwrap(M));
+  }
+  return LLVMRustResult::Success;
+}
+
+// Verifies a module with the function bodies sharded across a thread pool,
+// as a faster substitute for the serial whole-module VerifierPass that
+// -Zverify-llvm-ir prepends to the pipeline. Verification of one function
+// never mutates IR and never looks into another function's body, so shards
+// are independent; per-shard diagnostics are buffered and merged in shard
+// order, keeping the output deterministic. Function bodies dominate
+// verification time; module-level invariants (globals, aliases, comdats,
+// module metadata) are not covered, because LLVM's public verifier API has
+// no module-only entry point - callers that need those too must fall back
+// to the serial VerifierPass.
+//
+// Returns true if the module is valid; otherwise writes the collected
+// diagnostics to `ErrorsOut` and returns false.
+extern "C" bool LLVMRustVerifyModuleParallel(LLVMModuleRef M,
+                                             RustStringRef ErrorsOut) {
+  Module *TheModule = unwrap(M);
+
+  std::vector<Function *> Fns;
+  for (Function &F : *TheModule)
+    if (!F.isDeclaration())
+      Fns.push_back(&F);
+
+  WrapperTaskGroup Pool(LLVMRustJobPriority::Codegen);
+  size_t NumShards = std::max<size_t>(wrapperPoolConcurrency(), 1);
+  size_t ShardSize = (Fns.size() + NumShards - 1) / NumShards;
+
+  std::vector<std::string> ShardErrors(NumShards);
+  for (size_t Shard = 0; Shard < NumShards; Shard++) {
+    size_t Begin = Shard * ShardSize;
+    size_t End = std::min(Begin + ShardSize, Fns.size());
+    if (Begin >= End)
+      break;
+    Pool.async([&Fns, &ShardErrors, Shard, Begin, End] {
+      raw_string_ostream OS(ShardErrors[Shard]);
+      for (size_t i = Begin; i < End; i++)
+        verifyFunction(*Fns[i], &OS);
+      OS.flush();
+    });
+  }
+  Pool.wait();
+
+  RawRustStringOstream OS(ErrorsOut);
+  bool Broken = false;
+  for (const std::string &Errors : ShardErrors) {
+    if (!Errors.empty()) {
+      Broken = true;
+      OS << Errors;
+    }
+  }
+  return !Broken;
+}
+
+// Starts recording per-pass timings for every subsequent
+// LLVMRustOptimizeWithContext call on this context. Must be called before
+// the first module is optimized.
+extern "C" void
+LLVMRustOptimizeContextEnablePassTiming(LLVMRustOptimizeContext *Ctx) {
+  Ctx->PassTimings = std::make_unique<LLVMRustPassTimingRecorder>();
+  Ctx->PassTimings->registerCallbacks(Ctx->PIC);
+}
+
+// Arms the pass watchdog (see PassWatchdog) for every subsequent optimize
+// call on this context. A budget of zero disables that check; the wall
+// budget also starts the watcher thread, so a malloc-only budget is checked
+// purely at pass boundaries. Must be called before the first module is
+// optimized, and `Callback` may fire from a thread other than the one
+// running the pipeline.
+extern "C" void LLVMRustOptimizeContextEnablePassWatchdog(
+    LLVMRustOptimizeContext *Ctx, void *Handle,
+    LLVMRustPassWatchdogCallback Callback, uint64_t WallBudgetNanos,
+    int64_t MallocBudgetBytes) {
+  Ctx->Watchdog = std::make_unique<PassWatchdog>(
+      Handle, Callback, WallBudgetNanos, MallocBudgetBytes);
+  Ctx->Watchdog->registerCallbacks(Ctx->PIC);
+}
+
+// Makes every optimize call on this context report its module's malloc-usage
+// delta and the process peak RSS as a synthetic "LLVMRustModuleMemoryStats"
+// self-profile event. Has no effect unless the context was created with a
+// self-profiler.
+extern "C" void
+LLVMRustOptimizeContextEnableMemoryReporting(LLVMRustOptimizeContext *Ctx) {
+  Ctx->ReportMemoryDeltas = true;
+}
+
+// Switches this context to the buffered self-profile channel: pass events
+// are timestamped and completed in C++ and handed to `FlushCallback` in
+// blocks instead of one synchronous callback pair per event (see
+// SelfProfileEventQueue). Only valid on a context created without the
+// synchronous profiler - the two channels would otherwise both fire.
+extern "C" void LLVMRustOptimizeContextEnableBufferedProfiler(
+    LLVMRustOptimizeContext *Ctx, void *LlvmSelfProfiler,
+    LLVMRustSelfProfileFlushEventsCallback FlushCallback) {
+  assert(!Ctx->LlvmSelfProfiler &&
+         "context already has a synchronous self-profiler");
+  Ctx->BufferedProfile =
+      std::make_shared<SelfProfileEventQueue>(LlvmSelfProfiler, FlushCallback);
+  LLVMSelfProfileInitializeBufferedCallbacks(Ctx->PIC, Ctx->BufferedProfile);
+}
+
+// Forces out any buffered self-profile events; rustc calls this at module
+// boundaries so a module's events are visible before its object file is
+// handed on.
+extern "C" void
+LLVMRustOptimizeContextFlushProfileEvents(LLVMRustOptimizeContext *Ctx) {
+  if (Ctx->BufferedProfile)
+    Ctx->BufferedProfile->flush();
+}
+
+// Writes the timings recorded so far as a JSON array, one object per pass
+// name with its run count, total inclusive wall time in nanoseconds, and
+// net malloc-usage delta in bytes.
+extern "C" void
+LLVMRustOptimizeContextGetPassTimings(LLVMRustOptimizeContext *Ctx,
+                                      RustStringRef Out) {
+  RawRustStringOstream OS(Out);
+  if (!Ctx->PassTimings) {
+    OS << "[]";
+    return;
+  }
+
+  // Sort by pass name so the output is deterministic.
+  std::vector<const StringMapEntry<LLVMRustPassTiming> *> Entries;
+  for (const auto &Entry : Ctx->PassTimings->Timings)
+    Entries.push_back(&Entry);
+  std::sort(Entries.begin(), Entries.end(),
+            [](const auto *A, const auto *B) { return A->getKey() < B->getKey(); });
+
+  json::OStream J(OS);
+  J.arrayBegin();
+  for (const auto *Entry : Entries) {
+    const LLVMRustPassTiming &T = Entry->getValue();
+    J.object([&] {
+      J.attribute("pass", Entry->getKey());
+      J.attribute("runs", static_cast<int64_t>(T.Runs));
+      J.attribute("wall_ns", static_cast<int64_t>(T.WallNanos));
+      J.attribute("malloc_delta", T.MallocDelta);
+    });
+  }
+  J.arrayEnd();
+}
+
+extern "C" LLVMRustResult
+LLVMRustOptimize(
+    LLVMModuleRef ModuleRef,
+    LLVMTargetMachineRef TMRef,
+    LLVMRustPassBuilderOptLevel OptLevelRust,
+    LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
+    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    LLVMRustSanitizerOptions *SanitizerOptions,
+    const char *PGOGenPath, const char *PGOUsePath,
+    bool InstrumentCoverage, const char *InstrProfileOutput,
+    bool InstrumentGCOV,
+    const char *PGOSampleUsePath, bool DebugInfoForProfiling,
+    void* LlvmSelfProfiler,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const char *ExtraPasses, size_t ExtraPassesLen,
+    const char *LLVMPlugins, size_t LLVMPluginsLen) {
+  LLVM_RUST_TIME_ENTRY_POINT();
+  std::unique_ptr<LLVMRustOptimizeContext> Ctx(createOptimizeContext(
+      unwrap(TMRef), OptLevelRust, OptStage, NoPrepopulatePasses, VerifyIR,
+      UseThinLTOBuffers, MergeFunctions, UnrollLoops, SLPVectorize,
+      LoopVectorize, DisableSimplifyLibCalls, SanitizerOptions, PGOGenPath,
+      PGOUsePath, /*CSProfileGenPath=*/nullptr, /*CSProfileUsePath=*/nullptr,
+      InstrumentCoverage, InstrProfileOutput, InstrumentGCOV,
+      PGOSampleUsePath, DebugInfoForProfiling, LlvmSelfProfiler,
+      BeforePassCallback, AfterPassCallback, ExtraPasses, ExtraPassesLen,
+      LLVMPlugins, LLVMPluginsLen));
+  if (!Ctx)
+    return LLVMRustResult::Failure;
+  return optimizeWithContext(Ctx.get(), unwrap(ModuleRef),
+                             /*UpgradeIntrinsics=*/true);
+}
+
 // Callback to demangle function name
 // Parameters:
 // * name to be demangled
@@ -925,6 +2603,11 @@ namespace {
 class RustAssemblyAnnotationWriter : public AssemblyAnnotationWriter {
   DemangleFn Demangle;
   std::vector<char> Buf;
+  // Hot functions are referenced from thousands of call sites in the same
+  // module, so memoize the demangler results and cross the FFI boundary
+  // only once per unique symbol. An empty cached value means the name
+  // failed to demangle or demangles to itself.
+  StringMap<std::string> Cache;
 
 public:
   RustAssemblyAnnotationWriter(DemangleFn Demangle) : Demangle(Demangle) {}
@@ -936,25 +2619,28 @@ public:
       return StringRef();
     }
 
+    auto Cached = Cache.find(name);
+    if (Cached != Cache.end()) {
+      return Cached->second;
+    }
+
     if (Buf.size() < name.size() * 2) {
       // Semangled name usually shorter than mangled,
       // but allocate twice as much memory just in case
       Buf.resize(name.size() * 2);
     }
 
+    StringRef Demangled;
     auto R = Demangle(name.data(), name.size(), Buf.data(), Buf.size());
-    if (!R) {
-      // Demangle failed.
-      return StringRef();
-    }
-
-    auto Demangled = StringRef(Buf.data(), R);
-    if (Demangled == name) {
-      // Do not print anything if demangled name is equal to mangled.
-      return StringRef();
+    if (R) {
+      Demangled = StringRef(Buf.data(), R);
+      if (Demangled == name) {
+        // Do not print anything if demangled name is equal to mangled.
+        Demangled = StringRef();
+      }
     }
 
-    return Demangled;
+    return Cache.insert({name, Demangled.str()}).first->second;
   }
 
   void emitFunctionAnnot(const Function *F,
@@ -1017,20 +2703,241 @@ LLVMRustPrintModule(LLVMModuleRef M, const char *Path, DemangleFn Demangle) {
   return LLVMRustResult::Success;
 }
 
+// Like LLVMRustPrintModule, but compresses the printed IR with zstd before
+// writing it, for consumers that only ever feed the artifact to tooling.
+// For multi-gigabyte modules the uncompressed write dominates
+// --emit=llvm-ir, and zstd at its default level shrinks textual IR by an
+// order of magnitude. The IR is printed into memory and compressed in one
+// shot rather than per function: the module printer's slot numbering is
+// module-wide state, so printing functions independently (and in parallel)
+// would not reproduce the same output.
+extern "C" LLVMRustResult
+LLVMRustPrintModuleCompressed(LLVMModuleRef M, const char *Path,
+                              DemangleFn Demangle) {
+#if LLVM_VERSION_LT(16, 0)
+  // The compression::zstd API was added in LLVM 16.
+  LLVMRustSetLastError("zstd compression requires LLVM 16 or newer");
+  return LLVMRustResult::Failure;
+#else
+  if (!compression::zstd::isAvailable()) {
+    LLVMRustSetLastError("this LLVM was built without zstd support");
+    return LLVMRustResult::Failure;
+  }
+
+  SmallString<0> Printed;
+  {
+    RustAssemblyAnnotationWriter AAW(Demangle);
+    raw_svector_ostream SOS(Printed);
+    formatted_raw_ostream FOS(SOS);
+    unwrap(M)->print(FOS, &AAW);
+  }
+
+  SmallVector<uint8_t, 0> Compressed;
+  compression::zstd::compress(
+      ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Printed.data()),
+                        Printed.size()),
+      Compressed);
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  OS.write(reinterpret_cast<const char *>(Compressed.data()),
+           Compressed.size());
+
+  return LLVMRustResult::Success;
+#endif
+}
+
+// Incremental variant of LLVMRustPrintModule for IR-diff loops. The module
+// is still printed once into memory - the printer's module-level slot
+// numbering makes printing functions independently unreproducible, see the
+// note on LLVMRustPrintModuleCompressed - but each function definition's
+// text is then hashed, and when a manifest from the previous run is
+// supplied, unchanged functions are written as a one-line marker instead
+// of their body. The file on disk, and everything downstream that re-reads
+// and re-diffs it, then scales with the size of the change rather than the
+// module. The new manifest is handed back through `ManifestOut` as
+// `name_len:u64le, name bytes, hash:u64le` records; pass an empty previous
+// manifest to print everything and bootstrap one.
+extern "C" LLVMRustResult LLVMRustPrintModuleIncremental(
+    LLVMModuleRef M, const char *Path, DemangleFn Demangle,
+    const char *PrevManifestPtr, size_t PrevManifestLen,
+    RustStringRef ManifestOut) {
+  SmallString<0> Printed;
+  {
+    RustAssemblyAnnotationWriter AAW(Demangle);
+    raw_svector_ostream SOS(Printed);
+    formatted_raw_ostream FOS(SOS);
+    unwrap(M)->print(FOS, &AAW);
+  }
+
+  StringMap<uint64_t> Prev;
+  StringRef Rest(PrevManifestPtr, PrevManifestLen);
+  while (Rest.size() >= 8) {
+    uint64_t NameLen = support::endian::read64le(Rest.data());
+    Rest = Rest.drop_front(8);
+    if (Rest.size() < NameLen + 8)
+      break;
+    Prev[Rest.take_front(NameLen)] =
+        support::endian::read64le(Rest.data() + NameLen);
+    Rest = Rest.drop_front(NameLen + 8);
+  }
+
+  // Textual definitions appear in the same order as the module's function
+  // list; declarations print as single `declare` lines and stay part of
+  // the surrounding module prose, which is always written.
+  std::vector<const Function *> Defined;
+  for (const Function &F : *unwrap(M))
+    if (!F.isDeclaration())
+      Defined.push_back(&F);
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  RawRustStringOstream Manifest(ManifestOut);
+  auto WriteU64 = [](raw_ostream &Out, uint64_t Value) {
+    char Buf[8];
+    support::endian::write64le(Buf, Value);
+    Out.write(Buf, sizeof(Buf));
+  };
+
+  StringRef Text(Printed.data(), Printed.size());
+  size_t Pos = 0;
+  for (const Function *F : Defined) {
+    // A definition starts with `define ` at column zero and ends at the
+    // matching `}` at column zero; the printer never emits either inside a
+    // body, and embedded strings escape their newlines.
+    size_t DefPos;
+    if (Pos == 0 && Text.startswith("define ")) {
+      DefPos = 0;
+    } else {
+      DefPos = Text.find("\ndefine ", Pos == 0 ? 0 : Pos - 1);
+      if (DefPos == StringRef::npos)
+        break;
+      DefPos += 1;
+    }
+    size_t End = Text.find("\n}\n", DefPos);
+    End = End == StringRef::npos ? Text.size() : End + 3;
+
+    OS << Text.slice(Pos, DefPos);
+    StringRef Body = Text.slice(DefPos, End);
+    uint64_t Hash = xxHash64(Body);
+    auto It = Prev.find(F->getName());
+    if (It != Prev.end() && It->second == Hash)
+      OS << "; unchanged: " << F->getName() << "\n";
+    else
+      OS << Body;
+
+    WriteU64(Manifest, F->getName().size());
+    Manifest << F->getName();
+    WriteU64(Manifest, Hash);
+    Pos = End;
+  }
+  OS << Text.substr(Pos);
+
+  return LLVMRustResult::Success;
+}
+
 extern "C" void LLVMRustPrintPasses() {
   PassBuilder PB;
   PB.printPassNames(outs());
 }
 
-extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
-                                           size_t Len) {
-  auto PreserveFunctions = [=](const GlobalValue &GV) {
-    for (size_t I = 0; I < Len; I++) {
-      if (GV.getName() == Symbols[I]) {
-        return true;
-      }
+// Structured replacement for LLVMRustPrintPasses, which only dumps the
+// registry to stdout and forces tooling to spawn a compiler and scrape
+// text. Every registered pass is written to `Out` as a
+// `kind:u64le, is_analysis:u64le, name_len:u64le, name bytes` record,
+// with kind 0 for module, 1 for CGSCC, 2 for function and 3 for loop
+// scope. PassBuilder has no enumeration interface - the pass lists exist
+// only inside printPassNames - so the printed form is captured in memory
+// and parsed; its section-header-plus-indented-name layout is stable
+// across the LLVM versions we support.
+extern "C" void LLVMRustGetRegisteredPasses(RustStringRef Out) {
+  SmallString<0> Printed;
+  {
+    raw_svector_ostream OS(Printed);
+    PassBuilder PB;
+    PB.printPassNames(OS);
+  }
+
+  RawRustStringOstream OS(Out);
+  auto WriteU64 = [](raw_ostream &Dst, uint64_t Value) {
+    char Buf[8];
+    support::endian::write64le(Buf, Value);
+    Dst.write(Buf, sizeof(Buf));
+  };
+
+  uint64_t Kind = 0;
+  uint64_t IsAnalysis = 0;
+  bool InKnownSection = false;
+  StringRef Rest(Printed.data(), Printed.size());
+  while (!Rest.empty()) {
+    StringRef Line;
+    std::tie(Line, Rest) = Rest.split('\n');
+    if (Line.empty())
+      continue;
+    if (!Line.startswith("  ")) {
+      // A section header, e.g. "Function analyses:". "LoopNest passes"
+      // share the loop scope.
+      InKnownSection = true;
+      if (Line.startswith("Module"))
+        Kind = 0;
+      else if (Line.startswith("CGSCC"))
+        Kind = 1;
+      else if (Line.startswith("Function"))
+        Kind = 2;
+      else if (Line.startswith("Loop"))
+        Kind = 3;
+      else
+        InKnownSection = false;
+      IsAnalysis = Line.contains("analyses");
+      continue;
     }
+    if (!InKnownSection)
+      continue;
+    StringRef Name = Line.trim();
+    WriteU64(OS, Kind);
+    WriteU64(OS, IsAnalysis);
+    WriteU64(OS, Name.size());
+    OS << Name;
+  }
+}
+
+// Dry-runs PassBuilder's pipeline parser so extra-pass pipeline strings
+// can be validated in-process, without a module or a TargetMachine.
+// Returns true when the pipeline parses; otherwise writes the parse error
+// to `ErrorOut` and returns false.
+extern "C" bool LLVMRustValidatePassPipeline(const char *Pipeline,
+                                             RustStringRef ErrorOut) {
+  PassBuilder PB;
+  ModulePassManager MPM;
+  if (Error E = PB.parsePassPipeline(MPM, Pipeline)) {
+    RawRustStringOstream OS(ErrorOut);
+    OS << toString(std::move(E));
     return false;
+  }
+  return true;
+}
+
+extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
+                                           size_t Len) {
+  // The preserve callback runs once per global, so build a hash set up
+  // front rather than scanning the symbol array for each of them; staticlib
+  // builds pass tens of thousands of preserved symbols here.
+  StringSet<> PreservedSymbols;
+  for (size_t I = 0; I < Len; I++) {
+    PreservedSymbols.insert(Symbols[I]);
+  }
+
+  auto PreserveFunctions = [&](const GlobalValue &GV) {
+    return PreservedSymbols.count(GV.getName()) != 0;
   };
 
   internalizeModule(*unwrap(M), PreserveFunctions);
@@ -1059,6 +2966,29 @@ extern "C" void LLVMRustSetModuleCodeModel(LLVMModuleRef M,
   unwrap(M)->setCodeModel(*CM);
 }
 
+// One-shot version of the module setup above plus LLVMRustSetNormalizedTarget:
+// every new module needs its triple, data layout, PIC/PIE levels and code
+// model applied, and doing that through five separate FFI calls adds up over
+// hundreds of codegen units. The data layout comes straight from the
+// machine's canonical copy, so nothing is recomputed per module. `SetPIC` and
+// `SetPIE` mirror whether rustc would have called the individual level
+// setters; `Model` may be `None` to leave the code model untouched, like
+// LLVMRustSetModuleCodeModel.
+extern "C" void LLVMRustConfigureModule(LLVMModuleRef M,
+                                        LLVMTargetMachineRef TMR,
+                                        const char *TripleStr, bool SetPIC,
+                                        bool SetPIE, LLVMRustCodeModel Model) {
+  Module *Mod = unwrap(M);
+  Mod->setTargetTriple(Triple::normalize(TripleStr));
+  Mod->setDataLayout(unwrap(TMR)->createDataLayout());
+  if (SetPIC)
+    Mod->setPICLevel(PICLevel::Level::BigPIC);
+  if (SetPIE)
+    Mod->setPIELevel(PIELevel::Level::Large);
+  if (auto CM = fromRust(Model))
+    Mod->setCodeModel(*CM);
+}
+
 // Here you'll find an implementation of ThinLTO as used by the Rust compiler
 // right now. This ThinLTO support is only enabled on "recent ish" versions of
 // LLVM, and otherwise it's just blanket rejected from other compilers.
@@ -1112,6 +3042,23 @@ struct LLVMRustThinLTOData {
   StringMap<GVSummaryMapTy> ModuleToDefinedGVSummaries;
   StringMap<std::map<GlobalValue::GUID, GlobalValue::LinkageTypes>> ResolvedODR;
 
+  // The CFI function def/decl GUID sets only depend on the combined index, so
+  // they're computed once here instead of by every cache-key computation.
+  std::set<GlobalValue::GUID> CfiFunctionDefs;
+  std::set<GlobalValue::GUID> CfiFunctionDecls;
+
+  // Backing storage for modules registered by (path, offset, length) instead
+  // of by in-memory bytes; the ModuleMap entries point into these buffers.
+  std::vector<std::unique_ptr<MemoryBuffer>> OwnedBuffers;
+
+  // State for LLVMRustThinLTOModuleDone: how many backend jobs still need
+  // each module's summaries and serialized bytes (the module's own job plus
+  // one per importer), lazily derived from ImportLists on the first call.
+  // Only this bookkeeping takes the lock; the read paths above stay
+  // lock-free.
+  std::mutex DoneLock;
+  StringMap<unsigned> RemainingUses;
+
   LLVMRustThinLTOData() : Index(/* HaveGVs = */ false) {}
 };
 
@@ -1126,36 +3073,65 @@ struct LLVMRustThinLTOModule {
 // does.
 static const GlobalValueSummary *
 getFirstDefinitionForLinker(const GlobalValueSummaryList &GVSummaryList) {
-  auto StrongDefForLinker = llvm::find_if(
-      GVSummaryList, [](const std::unique_ptr<GlobalValueSummary> &Summary) {
-        auto Linkage = Summary->linkage();
-        return !GlobalValue::isAvailableExternallyLinkage(Linkage) &&
-               !GlobalValue::isWeakForLinker(Linkage);
-      });
-  if (StrongDefForLinker != GVSummaryList.end())
-    return StrongDefForLinker->get();
-
-  auto FirstDefForLinker = llvm::find_if(
-      GVSummaryList, [](const std::unique_ptr<GlobalValueSummary> &Summary) {
-        auto Linkage = Summary->linkage();
-        return !GlobalValue::isAvailableExternallyLinkage(Linkage);
-      });
-  if (FirstDefForLinker == GVSummaryList.end())
-    return nullptr;
-  return FirstDefForLinker->get();
+  // One pass instead of two find_if scans: the first strong definition wins
+  // outright, otherwise fall back to the first definition that isn't
+  // available_externally (which may be weak).
+  const GlobalValueSummary *FirstDefForLinker = nullptr;
+  for (const auto &Summary : GVSummaryList) {
+    auto Linkage = Summary->linkage();
+    if (GlobalValue::isAvailableExternallyLinkage(Linkage))
+      continue;
+    if (!GlobalValue::isWeakForLinker(Linkage))
+      return Summary.get();
+    if (!FirstDefForLinker)
+      FirstDefForLinker = Summary.get();
+  }
+  return FirstDefForLinker;
 }
 
 // The main entry point for creating the global ThinLTO analysis. The structure
 // here is basically the same as before threads are spawned in the `run`
 // function of `lib/LTO/ThinLTOCodeGenerator.cpp`.
-extern "C" LLVMRustThinLTOData*
-LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
-                          int num_modules,
-                          const char **preserved_symbols,
-                          int num_symbols) {
+static LLVMRustThinLTOData*
+createThinLTOData(LLVMRustThinLTOModule *modules,
+                  int num_modules,
+                  const char **preserved_symbols,
+                  int num_symbols,
+                  const uint64_t *preserved_guids,
+                  size_t num_guids) {
   auto Ret = std::make_unique<LLVMRustThinLTOData>();
 
-  // Load each module's summary and merge it into one combined index
+  // Convert the preserved symbols set from string to GUID, this is then needed
+  // for internalization. Hashing 100k+ symbol names (an MD5 each) is
+  // independent of the summary loading below, so it is sharded across the
+  // pool and runs concurrently with it rather than extending the serial
+  // phase; the hashes are merged into the set once both are done. Symbols
+  // whose GUIDs rustc already knows arrive pre-hashed in `preserved_guids`
+  // and skip the hashing entirely. The pool is also used to shard the
+  // per-symbol thin-link work further down.
+  WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
+  Ret->GUIDPreservedSymbols.reserve(num_symbols + num_guids);
+  for (size_t i = 0; i < num_guids; i++)
+    Ret->GUIDPreservedSymbols.insert(preserved_guids[i]);
+
+  std::vector<GlobalValue::GUID> HashedGUIDs(num_symbols);
+  {
+    size_t ShardSize = HashedGUIDs.size() / wrapperPoolConcurrency() + 1;
+    for (size_t Begin = 0; Begin < HashedGUIDs.size(); Begin += ShardSize) {
+      size_t End = std::min(Begin + ShardSize, HashedGUIDs.size());
+      Pool.async([&, Begin, End] {
+        for (size_t I = Begin; I < End; I++)
+          HashedGUIDs[I] = GlobalValue::getGUID(preserved_symbols[I]);
+      });
+    }
+  }
+
+  // Load each module's summary and merge it into one combined index.
+  //
+  // This loop itself has to stay serial: all summaries are merged into the
+  // single combined `ModuleSummaryIndex`, summaries hold `ValueInfo`
+  // references into their owning index, and LLVM doesn't expose a way to
+  // merge partial indexes after the fact.
   for (int i = 0; i < num_modules; i++) {
     auto module = &modules[i];
     StringRef buffer(module->data, module->len);
@@ -1165,19 +3141,18 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
 
     if (Error Err = readModuleSummaryIndex(mem_buffer, Ret->Index, i)) {
       LLVMRustSetLastError(toString(std::move(Err)).c_str());
+      Pool.wait();
       return nullptr;
     }
   }
 
-  // Collect for each module the list of function it defines (GUID -> Summary)
-  Ret->Index.collectDefinedGVSummariesPerModule(Ret->ModuleToDefinedGVSummaries);
+  Pool.wait();
 
-  // Convert the preserved symbols set from string to GUID, this is then needed
-  // for internalization.
-  for (int i = 0; i < num_symbols; i++) {
-    auto GUID = GlobalValue::getGUID(preserved_symbols[i]);
+  for (GlobalValue::GUID GUID : HashedGUIDs)
     Ret->GUIDPreservedSymbols.insert(GUID);
-  }
+
+  // Collect for each module the list of function it defines (GUID -> Summary)
+  Ret->Index.collectDefinedGVSummariesPerModule(Ret->ModuleToDefinedGVSummaries);
 
   // Collect the import/export lists for all modules from the call-graph in the
   // combined index
@@ -1197,9 +3172,31 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
   // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp` with some of this
   // being lifted from `lib/LTO/LTO.cpp` as well
   DenseMap<GlobalValue::GUID, const GlobalValueSummary *> PrevailingCopy;
-  for (auto &I : Ret->Index) {
-    if (I.second.SummaryList.size() > 1)
-      PrevailingCopy[I.first] = getFirstDefinitionForLinker(I.second.SummaryList);
+  {
+    // Resolving the prevailing copy of every multiply-defined symbol only
+    // reads the summary lists, so shard it across the pool. The results are
+    // merged back in index order, which keeps the outcome bit-identical to
+    // the old sequential loop.
+    std::vector<std::pair<GlobalValue::GUID, const GlobalValueSummaryList *>>
+        MultiDefs;
+    MultiDefs.reserve(Ret->Index.size());
+    for (auto &I : Ret->Index) {
+      if (I.second.SummaryList.size() > 1)
+        MultiDefs.push_back({I.first, &I.second.SummaryList});
+    }
+    std::vector<const GlobalValueSummary *> Resolved(MultiDefs.size());
+    size_t ShardSize = MultiDefs.size() / wrapperPoolConcurrency() + 1;
+    for (size_t Begin = 0; Begin < MultiDefs.size(); Begin += ShardSize) {
+      size_t End = std::min(Begin + ShardSize, MultiDefs.size());
+      Pool.async([&, Begin, End] {
+        for (size_t I = Begin; I < End; I++)
+          Resolved[I] = getFirstDefinitionForLinker(*MultiDefs[I].second);
+      });
+    }
+    Pool.wait();
+    PrevailingCopy.reserve(MultiDefs.size());
+    for (size_t I = 0; I < MultiDefs.size(); I++)
+      PrevailingCopy[MultiDefs[I].first] = Resolved[I];
   }
   auto isPrevailing = [&](GlobalValue::GUID GUID, const GlobalValueSummary *S) {
     const auto &Prevailing = PrevailingCopy.find(GUID);
@@ -1235,7 +3232,11 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
   // summaries in the index, and we basically just only want to ensure that dead
   // symbols are internalized. Otherwise everything that's already external
   // linkage will stay as external, and internal will stay as internal.
-  std::set<GlobalValue::GUID> ExportedGUIDs;
+  // Hashed and reserved up front: `isExported` below runs once per summary
+  // in the whole index, and a std::set probe per call was the single
+  // hottest part of the thin link after import computation.
+  DenseSet<GlobalValue::GUID> ExportedGUIDs;
+  ExportedGUIDs.reserve(Ret->Index.size());
   for (auto &List : Ret->Index) {
     for (auto &GVS: List.second.SummaryList) {
       if (GlobalValue::isLocalLinkage(GVS->linkage()))
@@ -1245,22 +3246,296 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
         ExportedGUIDs.insert(GUID);
     }
   }
+
+  // Per-module GUID sets for the export lists, so the callback doesn't redo
+  // ValueInfo hashing on every probe. The live-GUID set above is *not*
+  // merged in per module - it is shared by all modules and would be
+  // duplicated once per module - it just gets checked first, since it
+  // answers the common case with a single probe.
+  StringMap<DenseSet<GlobalValue::GUID>> ModuleExportGUIDs;
+  for (const auto &List : Ret->ExportLists) {
+    auto &GUIDs = ModuleExportGUIDs[List.first()];
+    GUIDs.reserve(List.second.size());
+    for (const ValueInfo &VI : List.second)
+      GUIDs.insert(VI.getGUID());
+  }
+
+  // Based on the 'InProcessThinBackend' constructor in LLVM. These are shared
+  // by all cache-key computations over this data. They only read the index's
+  // CFI name lists, which internalization below doesn't touch, so the GUID
+  // hashing overlaps with it.
+  Pool.async([&] {
+    for (auto &Name : Ret->Index.cfiFunctionDefs())
+      Ret->CfiFunctionDefs.insert(
+          GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
+    for (auto &Name : Ret->Index.cfiFunctionDecls())
+      Ret->CfiFunctionDecls.insert(
+          GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
+  });
+
   auto isExported = [&](StringRef ModuleIdentifier, ValueInfo VI) {
-    const auto &ExportList = Ret->ExportLists.find(ModuleIdentifier);
-    return (ExportList != Ret->ExportLists.end() &&
-      ExportList->second.count(VI)) ||
-      ExportedGUIDs.count(VI.getGUID());
+    if (ExportedGUIDs.count(VI.getGUID()))
+      return true;
+    const auto &ExportList = ModuleExportGUIDs.find(ModuleIdentifier);
+    return ExportList != ModuleExportGUIDs.end() &&
+           ExportList->second.count(VI.getGUID());
   };
   thinLTOInternalizeAndPromoteInIndex(Ret->Index, isExported, isPrevailing);
 
+  Pool.wait();
+
   return Ret.release();
 }
 
+extern "C" LLVMRustThinLTOData*
+LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
+                          int num_modules,
+                          const char **preserved_symbols,
+                          int num_symbols) {
+  return createThinLTOData(modules, num_modules, preserved_symbols,
+                           num_symbols, /*preserved_guids=*/nullptr,
+                           /*num_guids=*/0);
+}
+
+// Variant that additionally accepts preserved symbols as pre-hashed GUIDs
+// for the names whose hashes rustc already computed, so they don't get
+// MD5'd a second time here.
+extern "C" LLVMRustThinLTOData*
+LLVMRustCreateThinLTODataEx(LLVMRustThinLTOModule *modules,
+                            int num_modules,
+                            const char **preserved_symbols,
+                            int num_symbols,
+                            const uint64_t *preserved_guids,
+                            size_t num_guids) {
+  return createThinLTOData(modules, num_modules, preserved_symbols,
+                           num_symbols, preserved_guids, num_guids);
+}
+
+// A module registered by file location instead of by in-memory bytes.
+struct LLVMRustThinLTOModuleMapped {
+  const char *identifier;
+  const char *path;
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Variant of LLVMRustCreateThinLTODataEx that maps each module's bitcode
+// straight out of its file (typically the rlib it already lives in) instead
+// of taking a Rust-owned copy, so the bytes are resident once - in the page
+// cache - rather than duplicated in rustc's heap for the whole thin link.
+// The maps are owned by the returned data and stay valid as long as it does;
+// the underlying files must not change during the link. Returns null and
+// sets the last error if a file can't be mapped.
+extern "C" LLVMRustThinLTOData*
+LLVMRustCreateThinLTODataMapped(LLVMRustThinLTOModuleMapped *modules,
+                                int num_modules,
+                                const char **preserved_symbols,
+                                int num_symbols,
+                                const uint64_t *preserved_guids,
+                                size_t num_guids) {
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+  std::vector<LLVMRustThinLTOModule> InMemory;
+  Buffers.reserve(num_modules);
+  InMemory.reserve(num_modules);
+  for (int i = 0; i < num_modules; i++) {
+    auto BufOr = MemoryBuffer::getFileSlice(modules[i].path,
+                                            modules[i].length,
+                                            modules[i].offset,
+                                            /*IsVolatile=*/false);
+    if (std::error_code EC = BufOr.getError()) {
+      LLVMRustSetLastError(
+          (Twine(modules[i].path) + ": " + EC.message()).str().c_str());
+      return nullptr;
+    }
+    Buffers.push_back(std::move(*BufOr));
+    adviseHugePages(Buffers.back()->getBufferStart(),
+                    Buffers.back()->getBufferSize());
+    InMemory.push_back({modules[i].identifier, Buffers.back()->getBufferStart(),
+                        Buffers.back()->getBufferSize()});
+  }
+
+  LLVMRustThinLTOData *Ret =
+      createThinLTOData(InMemory.data(), num_modules, preserved_symbols,
+                        num_symbols, preserved_guids, num_guids);
+  if (Ret)
+    Ret->OwnedBuffers = std::move(Buffers);
+  return Ret;
+}
+
+// Cost estimate for one module's ThinLTO backend job, so the Rust-side
+// scheduler can start the expensive modules first instead of leaving them
+// for the long tail. Imports are the main predictor: every imported
+// function is parsed, materialized and optimized again in the importing
+// module.
+struct LLVMRustThinLTOModuleCost {
+  uint64_t NumImports;
+  uint64_t NumExports;
+  uint64_t DefinedInstCount;
+  uint64_t ImportedInstCount;
+};
+
+extern "C" void
+LLVMRustThinLTOGetModuleCost(const LLVMRustThinLTOData *Data,
+                             const char *ModId,
+                             LLVMRustThinLTOModuleCost *CostOut) {
+  *CostOut = LLVMRustThinLTOModuleCost{0, 0, 0, 0};
+
+  auto ExportList = Data->ExportLists.find(ModId);
+  if (ExportList != Data->ExportLists.end())
+    CostOut->NumExports = ExportList->second.size();
+
+  auto DefinedSummaries = Data->ModuleToDefinedGVSummaries.find(ModId);
+  if (DefinedSummaries != Data->ModuleToDefinedGVSummaries.end()) {
+    for (const auto &GVS : DefinedSummaries->second) {
+      if (const auto *FS = dyn_cast<FunctionSummary>(GVS.second))
+        CostOut->DefinedInstCount += FS->instCount();
+    }
+  }
+
+  auto ImportList = Data->ImportLists.find(ModId);
+  if (ImportList == Data->ImportLists.end())
+    return;
+  for (const auto &SrcModule : ImportList->second) {
+    CostOut->NumImports += SrcModule.second.size();
+    auto SrcSummaries =
+        Data->ModuleToDefinedGVSummaries.find(SrcModule.first());
+    if (SrcSummaries == Data->ModuleToDefinedGVSummaries.end())
+      continue;
+    for (const auto &GUID : SrcModule.second) {
+      auto GVS = SrcSummaries->second.find(GUID);
+      if (GVS == SrcSummaries->second.end())
+        continue;
+      if (const auto *FS = dyn_cast<FunctionSummary>(GVS->second))
+        CostOut->ImportedInstCount += FS->instCount();
+    }
+  }
+}
+
+// Serializes the combined summary index to `Path` as bitcode, in the same
+// format LLVM's own -thinlto-index files use. Incremental builds can use
+// this to skip rebuilding the thin-link when none of the inputs changed.
+// Patching individual modules' summaries into a deserialized index - which
+// would let a rebuild redo only the changed CGUs - is not possible from
+// here: readModuleSummaryIndex can only add summaries to an index, and LLVM
+// has no API for evicting the stale ones of a changed module.
+extern "C" LLVMRustResult
+LLVMRustWriteThinLTOIndexToFile(const LLVMRustThinLTOData *Data,
+                                const char *Path) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  writeIndexToFile(Data->Index, OS);
+  return LLVMRustResult::Success;
+}
+
+// Writes one module's slice of the thin link for a distributed backend:
+// a minimized index bitcode file at `IndexPath` containing only the
+// summaries this module's backend job will look at (its own plus those of
+// everything it imports), and a plain-text list of the modules it imports
+// from at `ImportsPath`. This is the wrapper equivalent of LLVM's
+// distributed-indexes mode: a remote worker needs only the shard, the
+// imports list, and the referenced bitcode files to run the backend for
+// this module.
+extern "C" LLVMRustResult
+LLVMRustWriteThinLTOIndexShard(const LLVMRustThinLTOData *Data,
+                               const char *ModId, const char *IndexPath,
+                               const char *ImportsPath) {
+  const auto &ImportList = Data->ImportLists.lookup(ModId);
+  std::map<std::string, GVSummaryMapTy> ModuleToSummariesForIndex;
+  gatherImportedSummariesForModule(ModId, Data->ModuleToDefinedGVSummaries,
+                                   ImportList, ModuleToSummariesForIndex);
+
+  std::error_code EC;
+  raw_fd_ostream OS(IndexPath, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  writeIndexToFile(Data->Index, OS, &ModuleToSummariesForIndex);
+
+  if (std::error_code ImportsEC =
+          EmitImportsFiles(ModId, ImportsPath, ModuleToSummariesForIndex)) {
+    LLVMRustSetLastError(ImportsEC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
 extern "C" void
 LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data) {
   delete Data;
 }
 
+// Releases the per-module state of `ModId` once its backend job has
+// finished, instead of keeping everything alive until LLVMRustFreeThinLTOData
+// and paying the whole thin-link's peak memory for the duration of the
+// backends. The module's import/export lists and ODR resolutions are only
+// read by its own pipeline, so they are dropped immediately. Its summary
+// map and serialized bytes are still read by any module that *imports from*
+// it, so those are reference-counted - one use for the module's own job plus
+// one per importer, derived from the import lists - and freed when the last
+// user is done.
+//
+// May be called concurrently from backend threads. The maps' buckets are
+// never touched, only the dead values inside them, so concurrent lookups of
+// other modules' entries remain safe; calling any prepare function for a
+// module after reporting it done is a contract violation.
+extern "C" void
+LLVMRustThinLTOModuleDone(LLVMRustThinLTOData *Data, const char *ModId) {
+  std::lock_guard<std::mutex> Guard(Data->DoneLock);
+
+  if (Data->RemainingUses.empty()) {
+    for (const auto &Mod : Data->ModuleMap)
+      Data->RemainingUses[Mod.first()] += 1;
+    for (const auto &Importer : Data->ImportLists)
+      for (const auto &Src : Importer.second)
+        Data->RemainingUses[Src.first()] += 1;
+  }
+
+  auto DropUse = [&](StringRef Id) {
+    auto Uses = Data->RemainingUses.find(Id);
+    if (Uses == Data->RemainingUses.end() || Uses->second == 0 ||
+        --Uses->second != 0)
+      return;
+    auto Summaries = Data->ModuleToDefinedGVSummaries.find(Id);
+    if (Summaries != Data->ModuleToDefinedGVSummaries.end())
+      Summaries->second.clear();
+    auto MapEntry = Data->ModuleMap.find(Id);
+    if (MapEntry != Data->ModuleMap.end()) {
+      // Unpin the backing buffer if this data owns it (modules registered
+      // from in-memory bytes are owned by the caller instead).
+      const char *Start = MapEntry->second.getBufferStart();
+      for (auto &Owned : Data->OwnedBuffers) {
+        if (Owned && Owned->getBufferStart() <= Start &&
+            Start < Owned->getBufferEnd()) {
+          Owned.reset();
+          break;
+        }
+      }
+      MapEntry->second = MemoryBufferRef();
+    }
+  };
+
+  auto Imports = Data->ImportLists.find(ModId);
+  if (Imports != Data->ImportLists.end()) {
+    // This module's job is over, so it no longer needs its sources.
+    for (const auto &Src : Imports->second)
+      DropUse(Src.first());
+    Imports->second = FunctionImporter::ImportMapTy();
+  }
+  auto Exports = Data->ExportLists.find(ModId);
+  if (Exports != Data->ExportLists.end())
+    Exports->second = FunctionImporter::ExportSetTy();
+  auto ODR = Data->ResolvedODR.find(ModId);
+  if (ODR != Data->ResolvedODR.end())
+    ODR->second.clear();
+
+  DropUse(ModId);
+}
+
 // Below are the various passes that happen *per module* when doing ThinLTO.
 //
 // In other words, these are the functions that are all run concurrently
@@ -1319,6 +3594,13 @@ LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
   TargetMachine &Target = *unwrap(TM);
 
   const auto &ImportList = Data->ImportLists.lookup(Mod.getModuleIdentifier());
+  // Note that while many destination modules import from the same hot source
+  // modules, the parsed `Module`s can't be cached and shared between the
+  // importing threads: each thread parses into its own `LLVMContext`, and IR
+  // is only usable from the context that owns it. The raw buffers in
+  // `Data->ModuleMap` and the summaries in `Data->Index` are the shareable
+  // representations, and both are already shared.
+  bool IsWasm = Target.getTargetTriple().isOSBinFormatWasm();
   auto Loader = [&](StringRef Identifier) {
     const auto &Memory = Data->ModuleMap.lookup(Identifier);
     auto &Context = Mod.getContext();
@@ -1327,6 +3609,12 @@ LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
     if (!MOrErr)
       return MOrErr;
 
+    // Only wasm modules can carry the custom sections the workaround below
+    // strips, so don't force metadata materialization for every import on
+    // other targets.
+    if (!IsWasm)
+      return MOrErr;
+
     // The rest of this closure is a workaround for
     // https://bugs.llvm.org/show_bug.cgi?id=38184 where during ThinLTO imports
     // we accidentally import wasm custom sections into different modules,
@@ -1362,6 +3650,225 @@ LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
   return true;
 }
 
+// Runs all four preparation phases - rename, weak-symbol resolution,
+// internalization, import - in one call. rustc only splits the phases when
+// it wants to save the intermediate bitcode between them (for incremental
+// caching and -C save-temps); when it doesn't, the split costs four FFI
+// crossings and repeats the module-identifier string handling and the
+// defined-summaries hash lookup in three of the four phases. Here the
+// lookup happens once and its result feeds both finalize and internalize.
+extern "C" bool
+LLVMRustPrepareThinLTOModule(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
+                             LLVMTargetMachineRef TM) {
+  Module &Mod = *unwrap(M);
+  TargetMachine &Target = *unwrap(TM);
+
+  bool ClearDSOLocal = clearDSOLocalOnDeclarations(Mod, Target);
+  if (renameModuleForThinLTO(Mod, Data->Index, ClearDSOLocal)) {
+    LLVMRustSetLastError("renameModuleForThinLTO failed");
+    return false;
+  }
+
+  const auto &DefinedGlobals =
+      Data->ModuleToDefinedGVSummaries.lookup(Mod.getModuleIdentifier());
+  thinLTOFinalizeInModule(Mod, DefinedGlobals, /*PropagateAttrs=*/true);
+  thinLTOInternalizeModule(Mod, DefinedGlobals);
+
+  return LLVMRustPrepareThinLTOImport(Data, M, TM);
+}
+
+// TargetMachines aren't thread-safe to share between backend workers, so
+// the end-to-end driver below builds one per job from the prototype the
+// caller configured. Returns null (with the last error set) for an unknown
+// target, which can only happen if the prototype's triple is stale.
+static std::unique_ptr<TargetMachine> cloneTargetMachine(TargetMachine *Proto) {
+  std::string Error;
+  const Target *TheTarget =
+      TargetRegistry::lookupTarget(Proto->getTargetTriple().getTriple(), Error);
+  if (!TheTarget) {
+    LLVMRustSetLastError(Error.c_str());
+    return nullptr;
+  }
+  return std::unique_ptr<TargetMachine>(TheTarget->createTargetMachine(
+      Proto->getTargetTriple().getTriple(), Proto->getTargetCPU(),
+      Proto->getTargetFeatureString(), Proto->Options,
+      Proto->getRelocationModel(), Proto->getCodeModel(),
+      Proto->getOptLevel()));
+}
+
+// Runs the whole ThinLTO backend - parse, rename, weak-symbol resolution,
+// internalization, import, optimization, codegen - for a set of modules on
+// an internal thread pool, writing each module's object to the matching
+// entry of `OutputPaths`. rustc previously drove the six stages per module
+// from its own scheduler with an FFI crossing and a scheduler hop between
+// each; here a worker carries one module through all stages back to back,
+// and the pool's shared queue keeps workers busy until the last module
+// finishes, fixing the tail utilization of big thin links. Returns false
+// with the last error set if any module fails; remaining jobs still run to
+// completion so every error is observed.
+extern "C" bool
+LLVMRustRunThinLTOBackend(const LLVMRustThinLTOData *Data,
+                          LLVMTargetMachineRef PrototypeTM,
+                          LLVMRustPassBuilderOptLevel OptLevel,
+                          LLVMRustFileType RustFileType,
+                          const char *const *ModuleIds,
+                          const char *const *OutputPaths, size_t NumModules) {
+  TargetMachine *Proto = unwrap(PrototypeTM);
+  auto FileType = fromRust(RustFileType);
+
+  std::vector<std::string> Errors(NumModules);
+  WrapperTaskGroup Pool(LLVMRustJobPriority::Codegen);
+  for (size_t i = 0; i < NumModules; i++) {
+    Pool.async([&, i] {
+      auto Fail = [&](const Twine &Msg) {
+        Errors[i] = (Twine(ModuleIds[i]) + ": " + Msg).str();
+      };
+
+      const auto &Memory = Data->ModuleMap.lookup(ModuleIds[i]);
+      if (!Memory.getBufferStart())
+        return Fail("not registered in the ThinLTO data");
+
+      LLVMContext Context;
+      Expected<std::unique_ptr<Module>> MOrErr =
+          parseBitcodeFile(Memory, Context);
+      if (!MOrErr)
+        return Fail(toString(MOrErr.takeError()));
+      Module &Mod = **MOrErr;
+
+      std::unique_ptr<TargetMachine> TM = cloneTargetMachine(Proto);
+      if (!TM)
+        return Fail("cannot create target machine");
+
+      LLVMModuleRef ModRef = wrap(&Mod);
+      LLVMTargetMachineRef TMRef = wrap(TM.get());
+      // The stage entry points report details through the Rust-side
+      // last-error slot, which isn't readable from here; the module and
+      // stage name are enough to rerun the failing job in isolation.
+      if (!LLVMRustPrepareThinLTORename(Data, ModRef, TMRef))
+        return Fail("rename failed");
+      if (!LLVMRustPrepareThinLTOResolveWeak(Data, ModRef))
+        return Fail("weak-symbol resolution failed");
+      if (!LLVMRustPrepareThinLTOInternalize(Data, ModRef))
+        return Fail("internalization failed");
+      if (!LLVMRustPrepareThinLTOImport(Data, ModRef, TMRef))
+        return Fail("import failed");
+
+      std::unique_ptr<LLVMRustOptimizeContext> OptCtx(createOptimizeContext(
+          TM.get(), OptLevel, LLVMRustOptStage::ThinLTO,
+          /*NoPrepopulatePasses=*/false, /*VerifyIR=*/false,
+          /*UseThinLTOBuffers=*/false, /*MergeFunctions=*/false,
+          /*UnrollLoops=*/true, /*SLPVectorize=*/true, /*LoopVectorize=*/true,
+          /*DisableSimplifyLibCalls=*/false, /*SanitizerOptions=*/nullptr,
+          /*PGOGenPath=*/nullptr, /*PGOUsePath=*/nullptr,
+          /*CSProfileGenPath=*/nullptr, /*CSProfileUsePath=*/nullptr,
+          /*InstrumentCoverage=*/false, /*InstrProfileOutput=*/nullptr,
+          /*InstrumentGCOV=*/false, /*PGOSampleUsePath=*/nullptr,
+          /*DebugInfoForProfiling=*/false, /*LlvmSelfProfiler=*/nullptr,
+          /*BeforePassCallback=*/nullptr, /*AfterPassCallback=*/nullptr,
+          /*ExtraPasses=*/"", /*ExtraPassesLen=*/0,
+          /*LLVMPlugins=*/"", /*LLVMPluginsLen=*/0));
+      if (!OptCtx)
+        return Fail("cannot build optimization pipeline");
+      if (optimizeWithContext(OptCtx.get(), &Mod,
+                              /*UpgradeIntrinsics=*/false) !=
+          LLVMRustResult::Success)
+        return Fail("optimization failed");
+
+      std::error_code EC;
+      raw_fd_ostream OS(OutputPaths[i], EC, sys::fs::OF_None);
+      if (EC)
+        return Fail(EC.message());
+      buffer_ostream BOS(OS);
+      llvm::legacy::PassManager PM;
+      TM->addPassesToEmitFile(PM, BOS, nullptr, FileType, false);
+      PM.run(Mod);
+    });
+  }
+  Pool.wait();
+
+  std::string Joined;
+  for (const std::string &Error : Errors) {
+    if (Error.empty())
+      continue;
+    if (!Joined.empty())
+      Joined += "; ";
+    Joined += Error;
+  }
+  if (!Joined.empty()) {
+    LLVMRustSetLastError(Joined.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Huge-page advice for the wrapper's large flat buffers. The dTLB pressure
+// of a big compile mostly comes from the IR heap, but LLVMContextImpl's
+// BumpPtrAllocator is private and has no slab hook, so the context's
+// allocator cannot be backed with 2 MB slabs from this side of the API.
+// What the wrapper does own are the multi-megabyte bitcode buffers around
+// a (Thin)LTO link; advising those MADV_HUGEPAGE lets khugepaged collapse
+// them, removing most of the TLB cost of scanning them. Opt-in, because
+// the collapse is page-table work that short-lived compiles never recoup.
+static std::atomic<bool> HugePageBuffersEnabled{false};
+
+extern "C" void LLVMRustEnableHugePageBuffers(bool Enable) {
+  HugePageBuffersEnabled.store(Enable, std::memory_order_relaxed);
+}
+
+// Best-effort, like adviseRange in ArchiveWrapper.cpp: sub-huge-page
+// buffers are skipped, the start is rounded down to a page boundary, and
+// failures (THP disabled, file-backed memory) are ignored.
+static void adviseHugePages(const void *Ptr, size_t Len) {
+#if defined(__linux__)
+  const size_t HugePageSize = 2 * 1024 * 1024;
+  if (Len < HugePageSize ||
+      !HugePageBuffersEnabled.load(std::memory_order_relaxed))
+    return;
+  uintptr_t PageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+  uintptr_t Start = (uintptr_t)Ptr & ~PageMask;
+  (void)madvise((void *)Start, Len + ((uintptr_t)Ptr - Start), MADV_HUGEPAGE);
+#else
+  (void)Ptr;
+  (void)Len;
+#endif
+}
+
+// Reports how much of the process the kernel actually backs with huge
+// pages (anonymous and file-backed PMD mappings, in bytes), so the effect
+// of LLVMRustEnableHugePageBuffers is measured rather than assumed.
+// Returns false where the numbers aren't available (non-Linux, no /proc).
+extern "C" bool LLVMRustHugePageStats(uint64_t *AnonHugeBytesOut,
+                                      uint64_t *FileHugeBytesOut) {
+#if defined(__linux__)
+  // smaps_rollup has no stat-reported size, so a streaming read is needed.
+  auto BufOr = MemoryBuffer::getFileAsStream("/proc/self/smaps_rollup");
+  if (!BufOr)
+    return false;
+  *AnonHugeBytesOut = 0;
+  *FileHugeBytesOut = 0;
+  StringRef Rest = (*BufOr)->getBuffer();
+  while (!Rest.empty()) {
+    StringRef Line;
+    std::tie(Line, Rest) = Rest.split('\n');
+    uint64_t *Out = nullptr;
+    if (Line.consume_front("AnonHugePages:"))
+      Out = AnonHugeBytesOut;
+    else if (Line.consume_front("FilePmdMapped:"))
+      Out = FileHugeBytesOut;
+    else
+      continue;
+    uint64_t KiB;
+    if (!Line.trim().consumeInteger(10, KiB))
+      *Out = KiB * 1024;
+  }
+  return true;
+#else
+  (void)AnonHugeBytesOut;
+  (void)FileHugeBytesOut;
+  return false;
+#endif
+}
+
 // This struct and various functions are sort of a hack right now, but the
 // problem is that we've got in-memory LLVM modules after we generate and
 // optimize all codegen-units for one compilation in rustc. To be compatible
@@ -1374,32 +3881,214 @@ struct LLVMRustThinLTOBuffer {
   std::string data;
 };
 
+static void serializeModuleForThinLTO(Module *M, raw_ostream &OS,
+                                      bool is_thin) {
+  if (is_thin) {
+    PassBuilder PB;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    ModulePassManager MPM;
+    MPM.addPass(ThinLTOBitcodeWriterPass(OS, nullptr));
+    MPM.run(*M, MAM);
+  } else {
+    WriteBitcodeToFile(*M, OS);
+  }
+}
+
+// `CapacityHint` preallocates the output string so multi-megabyte modules
+// don't grow it by repeated reallocation; rustc passes the size from the
+// previous build of the same CGU when it has one, and 0 means no hint.
 extern "C" LLVMRustThinLTOBuffer*
-LLVMRustThinLTOBufferCreate(LLVMModuleRef M, bool is_thin) {
+LLVMRustThinLTOBufferCreateWithCapacity(LLVMModuleRef M, bool is_thin,
+                                        size_t CapacityHint) {
+  LLVM_RUST_TIME_ENTRY_POINT();
   auto Ret = std::make_unique<LLVMRustThinLTOBuffer>();
+  if (CapacityHint)
+    Ret->data.reserve(CapacityHint);
   {
     raw_string_ostream OS(Ret->data);
-    {
-      if (is_thin) {
-        PassBuilder PB;
-        LoopAnalysisManager LAM;
-        FunctionAnalysisManager FAM;
-        CGSCCAnalysisManager CGAM;
-        ModuleAnalysisManager MAM;
-        PB.registerModuleAnalyses(MAM);
-        PB.registerCGSCCAnalyses(CGAM);
-        PB.registerFunctionAnalyses(FAM);
-        PB.registerLoopAnalyses(LAM);
-        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-        ModulePassManager MPM;
-        MPM.addPass(ThinLTOBitcodeWriterPass(OS, nullptr));
-        MPM.run(*unwrap(M), MAM);
-      } else {
-        WriteBitcodeToFile(*unwrap(M), OS);
-      }
+    serializeModuleForThinLTO(unwrap(M), OS, is_thin);
+  }
+  adviseHugePages(Ret->data.data(), Ret->data.size());
+  return Ret.release();
+}
+
+extern "C" LLVMRustThinLTOBuffer*
+LLVMRustThinLTOBufferCreate(LLVMModuleRef M, bool is_thin) {
+  return LLVMRustThinLTOBufferCreateWithCapacity(M, is_thin, 0);
+}
+
+// Metadata classes LLVMRustThinLTOBufferCreateStripped can drop before
+// serialization. Usable as a bitmask.
+enum LLVMRustThinLTOStripClass : uint32_t {
+  // Debug intrinsics, !dbg attachments and the debug compile units; in a
+  // release build the ThinLTO backend never reads them, and they are the
+  // bulk of rlib bitcode when any dependency was built with debuginfo.
+  LLVMRustThinLTOStripDebugInfo = 1 << 0,
+  // Named metadata the backend doesn't consume (llvm.ident,
+  // llvm.commandline, ...). Module flags, linker options and dependent
+  // libraries are kept - the linker plumbing reads those.
+  LLVMRustThinLTOStripNamedMetadata = 1 << 1,
+};
+
+// Like LLVMRustThinLTOBufferCreate, but strips the requested metadata
+// classes from the module first, shrinking the buffer and everything
+// downstream that parses it. The strip mutates the module in place;
+// serialization is normally the module's last use, and callers who still
+// need the metadata afterwards must not ask for this.
+extern "C" LLVMRustThinLTOBuffer *
+LLVMRustThinLTOBufferCreateStripped(LLVMModuleRef M, bool is_thin,
+                                    uint32_t StripClasses) {
+  Module *Mod = unwrap(M);
+  if (StripClasses & LLVMRustThinLTOStripDebugInfo)
+    StripDebugInfo(*Mod);
+  if (StripClasses & LLVMRustThinLTOStripNamedMetadata) {
+    SmallVector<NamedMDNode *, 8> Dead;
+    for (NamedMDNode &NMD : Mod->named_metadata()) {
+      StringRef Name = NMD.getName();
+      if (Name == "llvm.module.flags" || Name == "llvm.linker.options" ||
+          Name == "llvm.dependent-libraries")
+        continue;
+      Dead.push_back(&NMD);
     }
+    for (NamedMDNode *NMD : Dead)
+      Mod->eraseNamedMetadata(NMD);
+  }
+  return LLVMRustThinLTOBufferCreate(M, is_thin);
+}
+
+// Serialization of a 100 MB+ fat-LTO module is seconds of single-threaded
+// work, and the bitcode writer can't be parallelized within one module: the
+// stream's value numbering, abbreviation IDs and forward references are
+// global, so independently serialized function blocks could not be
+// stitched back together. What *can* be done is taking that work off the
+// codegen thread entirely: the async variant runs the same writer on a
+// shared background pool (output bytes are identical) while the caller
+// moves on, and the join call collects the finished buffer. The module must
+// not be touched between create and join; serializing is typically its last
+// use anyway.
+struct LLVMRustAsyncThinLTOBuffer {
+  LLVMRustThinLTOBuffer Buffer;
+  std::shared_future<void> Done;
+};
+
+extern "C" LLVMRustAsyncThinLTOBuffer *
+LLVMRustThinLTOBufferCreateAsync(LLVMModuleRef M, bool is_thin) {
+  auto Ret = std::make_unique<LLVMRustAsyncThinLTOBuffer>();
+  LLVMRustThinLTOBuffer *Out = &Ret->Buffer;
+  Ret->Done = wrapperPoolSubmit(
+      LLVMRustJobPriority::ThinLink, [M, is_thin, Out] {
+        raw_string_ostream OS(Out->data);
+        serializeModuleForThinLTO(unwrap(M), OS, is_thin);
+        adviseHugePages(Out->data.data(), Out->data.size());
+      });
+  return Ret.release();
+}
+
+// Waits for the serialization started by LLVMRustThinLTOBufferCreateAsync
+// and returns the finished buffer (to be freed with
+// LLVMRustThinLTOBufferFree); the async handle is consumed.
+extern "C" LLVMRustThinLTOBuffer *
+LLVMRustThinLTOBufferAsyncJoin(LLVMRustAsyncThinLTOBuffer *Async) {
+  Async->Done.wait();
+  auto Ret =
+      std::make_unique<LLVMRustThinLTOBuffer>(std::move(Async->Buffer));
+  delete Async;
+  return Ret.release();
+}
+
+// Framing for compressed ThinLTO buffers: a magic prefix, the uncompressed
+// size as a little-endian u64 (zstd wants the output size up front), then
+// the zstd frame. The magic lets the parse entry points below decompress
+// transparently while still accepting plain bitcode.
+static const char ThinLTOZstdMagic[8] = {'R', 'S', 'T', 'C', 'B', 'C', '0',
+                                         '1'};
+
+static bool isCompressedThinLTOBuffer(StringRef Data) {
+  return Data.size() >= sizeof(ThinLTOZstdMagic) + 8 &&
+         Data.startswith(StringRef(ThinLTOZstdMagic, sizeof(ThinLTOZstdMagic)));
+}
+
+static Error decompressThinLTOBuffer(StringRef Data,
+                                     SmallVectorImpl<uint8_t> &Out) {
+#if LLVM_VERSION_LT(16, 0)
+  // The compression::zstd API was added in LLVM 16; a compressed buffer
+  // reaching an older build is still reported cleanly through the parse
+  // entry points' error paths.
+  return createStringError(inconvertibleErrorCode(),
+                           "zstd decompression requires LLVM 16 or newer");
+#else
+  uint64_t UncompressedSize =
+      support::endian::read64le(Data.data() + sizeof(ThinLTOZstdMagic));
+  StringRef Payload = Data.drop_front(sizeof(ThinLTOZstdMagic) + 8);
+  return compression::zstd::decompress(
+      ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Payload.data()),
+                        Payload.size()),
+      Out, UncompressedSize);
+#endif
+}
+
+// Like LLVMRustThinLTOBufferCreate, but compresses the serialized module
+// with zstd at the given level. Bitcode stored in rlibs and the incremental
+// cache is written once and read many times, so trading cheap CPU for a
+// large cut in I/O volume is usually a win. Returns null and sets the last
+// error when this LLVM was built without zstd.
+extern "C" LLVMRustThinLTOBuffer*
+LLVMRustThinLTOBufferCreateCompressed(LLVMModuleRef M, bool is_thin,
+                                      int Level) {
+#if LLVM_VERSION_LT(16, 0)
+  LLVMRustSetLastError("zstd compression requires LLVM 16 or newer");
+  return nullptr;
+#else
+  if (!compression::zstd::isAvailable()) {
+    LLVMRustSetLastError("this LLVM was built without zstd support");
+    return nullptr;
   }
+
+  SmallString<0> Raw;
+  {
+    raw_svector_ostream OS(Raw);
+    serializeModuleForThinLTO(unwrap(M), OS, is_thin);
+  }
+
+  SmallVector<uint8_t, 0> Compressed;
+  compression::zstd::compress(
+      ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Raw.data()),
+                        Raw.size()),
+      Compressed, Level);
+
+  auto Ret = std::make_unique<LLVMRustThinLTOBuffer>();
+  Ret->data.reserve(sizeof(ThinLTOZstdMagic) + 8 + Compressed.size());
+  Ret->data.append(ThinLTOZstdMagic, sizeof(ThinLTOZstdMagic));
+  char SizeBytes[8];
+  support::endian::write64le(SizeBytes, Raw.size());
+  Ret->data.append(SizeBytes, sizeof(SizeBytes));
+  Ret->data.append(reinterpret_cast<const char *>(Compressed.data()),
+                   Compressed.size());
   return Ret.release();
+#endif
+}
+
+// Streams the serialized module straight into `Path` instead of building an
+// in-memory buffer first, for callers that only ever write the buffer out.
+extern "C" LLVMRustResult
+LLVMRustThinLTOBufferWriteToFile(LLVMModuleRef M, bool is_thin,
+                                 const char *Path) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  serializeModuleForThinLTO(unwrap(M), OS, is_thin);
+  return LLVMRustResult::Success;
 }
 
 extern "C" void
@@ -1426,6 +4115,18 @@ LLVMRustParseBitcodeForLTO(LLVMContextRef Context,
                            size_t len,
                            const char *identifier) {
   StringRef Data(data, len);
+  // Buffers from LLVMRustThinLTOBufferCreateCompressed are decompressed
+  // transparently; parseBitcodeFile copies everything it needs out of the
+  // buffer, so the decompressed bytes can be dropped when this returns.
+  SmallVector<uint8_t, 0> Decompressed;
+  if (isCompressedThinLTOBuffer(Data)) {
+    if (Error E = decompressThinLTOBuffer(Data, Decompressed)) {
+      LLVMRustSetLastError(toString(std::move(E)).c_str());
+      return nullptr;
+    }
+    Data = StringRef(reinterpret_cast<const char *>(Decompressed.data()),
+                     Decompressed.size());
+  }
   MemoryBufferRef Buffer(Data, identifier);
   unwrap(Context)->enableDebugTypeODRUniquing();
   Expected<std::unique_ptr<Module>> SrcOrError =
@@ -1437,6 +4138,47 @@ LLVMRustParseBitcodeForLTO(LLVMContextRef Context,
   return wrap(std::move(*SrcOrError).release());
 }
 
+// Lazy variant of `LLVMRustParseBitcodeForLTO`: only the module skeleton and
+// summary are parsed up front, function bodies are materialized on demand (the
+// same way `LLVMRustPrepareThinLTOImport`'s loader reads import sources).
+// After import/internalize has decided what's live this avoids decoding the
+// bodies that are about to be thrown away. Callers that need the whole module
+// (e.g. before serializing it again) must call
+// `LLVMRustModuleMaterializeAll` first.
+extern "C" LLVMModuleRef
+LLVMRustParseBitcodeForLTOLazy(LLVMContextRef Context,
+                               const char *data,
+                               size_t len,
+                               const char *identifier) {
+  StringRef Data(data, len);
+  // Lazy materialization keeps reading from the backing buffer for the
+  // module's whole lifetime, so there is nowhere to own decompressed bytes;
+  // compressed buffers must go through the eager parse instead.
+  if (isCompressedThinLTOBuffer(Data)) {
+    LLVMRustSetLastError("compressed bitcode cannot be lazily loaded");
+    return nullptr;
+  }
+  MemoryBufferRef Buffer(Data, identifier);
+  unwrap(Context)->enableDebugTypeODRUniquing();
+  Expected<std::unique_ptr<Module>> SrcOrError =
+      getLazyBitcodeModule(Buffer, *unwrap(Context),
+                           /*ShouldLazyLoadMetadata=*/true,
+                           /*IsImporting=*/false);
+  if (!SrcOrError) {
+    LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
+    return nullptr;
+  }
+  return wrap(std::move(*SrcOrError).release());
+}
+
+extern "C" LLVMRustResult LLVMRustModuleMaterializeAll(LLVMModuleRef M) {
+  if (Error Err = unwrap(M)->materializeAll()) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
 // Find the bitcode section in the object file data and return it as a slice.
 // Fail if the bitcode section is present but empty.
 //
@@ -1463,6 +4205,51 @@ LLVMRustGetBitcodeSliceFromObjectData(const char *data,
   return BitcodeOrError->getBufferStart();
 }
 
+// One result of a LLVMRustFindBitcodeSlices scan. `Offset`/`Len` locate the
+// bitcode relative to the start of the member's own slice; both are zero
+// when `IsBitcode` is false.
+struct LLVMRustBitcodeSlice {
+  uint64_t Offset;
+  uint64_t Len;
+  bool IsBitcode;
+};
+
+// Batch form of LLVMRustGetBitcodeSliceFromObjectData over all members of
+// an rlib: takes every member's slice at once, scans them in parallel on
+// the thread pool, and fills one record per member. Members that contain
+// no bitcode (e.g. compression metadata files) simply come back with
+// IsBitcode unset rather than producing an error, so preparing a
+// 3,000-member rlib for ThinLTO is one crossing and one pass.
+extern "C" void LLVMRustFindBitcodeSlices(const char *const *BufPtrs,
+                                          const size_t *BufLens,
+                                          size_t NumBufs,
+                                          LLVMRustBitcodeSlice *SlicesOut) {
+  WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
+  size_t ShardSize = NumBufs / wrapperPoolConcurrency() + 1;
+  for (size_t Begin = 0; Begin < NumBufs; Begin += ShardSize) {
+    size_t End = std::min(Begin + ShardSize, NumBufs);
+    Pool.async([=] {
+      for (size_t i = Begin; i < End; i++) {
+        SlicesOut[i] = {0, 0, false};
+        MemoryBufferRef Buffer(StringRef(BufPtrs[i], BufLens[i]), "");
+        Expected<MemoryBufferRef> BitcodeOrError =
+            object::IRObjectFile::findBitcodeInMemBuffer(Buffer);
+        if (!BitcodeOrError) {
+          // Not an error for a batch scan: the member just isn't an LTO
+          // input.
+          consumeError(BitcodeOrError.takeError());
+          continue;
+        }
+        SlicesOut[i].Offset =
+            BitcodeOrError->getBufferStart() - BufPtrs[i];
+        SlicesOut[i].Len = BitcodeOrError->getBufferSize();
+        SlicesOut[i].IsBitcode = true;
+      }
+    });
+  }
+  Pool.wait();
+}
+
 // Computes the LTO cache key for the provided 'ModId' in the given 'Data',
 // storing the result in 'KeyOut'.
 // Currently, this cache key is a SHA-1 hash of anything that could affect
@@ -1470,28 +4257,51 @@ LLVMRustGetBitcodeSliceFromObjectData(const char *data,
 // of access globals, etc).
 // The precise details are determined by LLVM in `computeLTOCacheKey`, which is
 // used during the normal linker-plugin incremental thin-LTO process.
-extern "C" void
-LLVMRustComputeLTOCacheKey(RustStringRef KeyOut, const char *ModId, LLVMRustThinLTOData *Data) {
-  SmallString<40> Key;
+static void computeLTOCacheKeyForModule(const LLVMRustThinLTOData *Data,
+                                        StringRef ModId,
+                                        SmallString<40> &Key) {
   llvm::lto::Config conf;
   const auto &ImportList = Data->ImportLists.lookup(ModId);
   const auto &ExportList = Data->ExportLists.lookup(ModId);
   const auto &ResolvedODR = Data->ResolvedODR.lookup(ModId);
   const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.lookup(ModId);
-  std::set<GlobalValue::GUID> CfiFunctionDefs;
-  std::set<GlobalValue::GUID> CfiFunctionDecls;
-
-  // Based on the 'InProcessThinBackend' constructor in LLVM
-  for (auto &Name : Data->Index.cfiFunctionDefs())
-    CfiFunctionDefs.insert(
-        GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
-  for (auto &Name : Data->Index.cfiFunctionDecls())
-    CfiFunctionDecls.insert(
-        GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
 
   llvm::computeLTOCacheKey(Key, conf, Data->Index, ModId,
-      ImportList, ExportList, ResolvedODR, DefinedGlobals, CfiFunctionDefs, CfiFunctionDecls
+      ImportList, ExportList, ResolvedODR, DefinedGlobals,
+      Data->CfiFunctionDefs, Data->CfiFunctionDecls
   );
+}
+
+extern "C" void
+LLVMRustComputeLTOCacheKey(RustStringRef KeyOut, const char *ModId, LLVMRustThinLTOData *Data) {
+  SmallString<40> Key;
+  computeLTOCacheKeyForModule(Data, ModId, Key);
 
   LLVMRustStringWriteImpl(KeyOut, Key.c_str(), Key.size());
 }
+
+// Computes the cache keys for all of `ModIds` in one call, in parallel. The
+// keys are written to `KeysOut` in input order, each terminated by a NUL byte
+// (the keys themselves are hex strings).
+extern "C" void
+LLVMRustComputeLTOCacheKeys(RustStringRef KeysOut, const char *const *ModIds,
+                            size_t NumModIds, LLVMRustThinLTOData *Data) {
+  std::vector<SmallString<40>> Keys(NumModIds);
+
+  WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
+  for (size_t I = 0; I < NumModIds; I++) {
+    Pool.async([&, I] {
+      computeLTOCacheKeyForModule(Data, ModIds[I], Keys[I]);
+    });
+  }
+  Pool.wait();
+
+  size_t TotalSize = 0;
+  for (const auto &Key : Keys)
+    TotalSize += Key.size() + 1;
+  LLVMRustStringReserveImpl(KeysOut, TotalSize);
+  for (const auto &Key : Keys) {
+    LLVMRustStringWriteImpl(KeysOut, Key.data(), Key.size());
+    LLVMRustStringWriteImpl(KeysOut, "\0", 1);
+  }
+}
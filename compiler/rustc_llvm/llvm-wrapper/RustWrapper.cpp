@@ -8,11 +8,14 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IntrinsicsARM.h"
 #include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Remarks/RemarkStreamer.h"
 #include "llvm/Remarks/RemarkSerializer.h"
 #include "llvm/Remarks/RemarkFormat.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/xxhash.h"
 #if LLVM_VERSION_GE(16, 0)
 #include "llvm/Support/ModRef.h"
 #endif
@@ -21,12 +24,19 @@
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Pass.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Signals.h"
 #if LLVM_VERSION_LT(16, 0)
 #include "llvm/ADT/Optional.h"
 #endif
 
 #include <iostream>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 //===----------------------------------------------------------------------===
 //
@@ -106,6 +116,51 @@ extern "C" LLVMContextRef LLVMRustContextCreate(bool shouldDiscardNames) {
   return wrap(ctx);
 }
 
+// A pool of LLVMContexts that worker threads can recycle between codegen
+// units instead of paying for construction and teardown of the interning
+// tables hundreds of times per crate. LLVMContext has no API to clear its
+// interned types and constants, so a recycled context deliberately keeps
+// them warm; per-context configuration that may point into Rust state (the
+// diagnostic handler) is reset on release. Long-running processes should
+// call LLVMRustContextPoolClear when a build finishes to return the
+// memory.
+static struct {
+  std::mutex Lock;
+  std::vector<LLVMContext *> Contexts;
+} ContextPool;
+
+extern "C" LLVMContextRef LLVMRustContextAcquireFromPool(
+    bool shouldDiscardNames) {
+  LLVMContext *Ctx = nullptr;
+  {
+    std::lock_guard<std::mutex> Guard(ContextPool.Lock);
+    if (!ContextPool.Contexts.empty()) {
+      Ctx = ContextPool.Contexts.back();
+      ContextPool.Contexts.pop_back();
+    }
+  }
+  if (!Ctx)
+    Ctx = new LLVMContext();
+  Ctx->setDiscardValueNames(shouldDiscardNames);
+  return wrap(Ctx);
+}
+
+extern "C" void LLVMRustContextReleaseToPool(LLVMContextRef C) {
+  LLVMContext *Ctx = unwrap(C);
+  // Drop any handler installed for the previous module; it may reference
+  // Rust-side state that doesn't outlive the codegen unit.
+  Ctx->setDiagnosticHandler(std::make_unique<DiagnosticHandler>());
+  std::lock_guard<std::mutex> Guard(ContextPool.Lock);
+  ContextPool.Contexts.push_back(Ctx);
+}
+
+extern "C" void LLVMRustContextPoolClear() {
+  std::lock_guard<std::mutex> Guard(ContextPool.Lock);
+  for (LLVMContext *Ctx : ContextPool.Contexts)
+    delete Ctx;
+  ContextPool.Contexts.clear();
+}
+
 extern "C" void LLVMRustSetNormalizedTarget(LLVMModuleRef M,
                                             const char *Triple) {
   unwrap(M)->setTargetTriple(Triple::normalize(Triple));
@@ -132,6 +187,31 @@ extern "C" LLVMValueRef LLVMRustGetOrInsertFunction(LLVMModuleRef M,
   );
 }
 
+// One record of LLVMRustGetOrInsertFunctions.
+struct LLVMRustFunctionDecl {
+  const char *Name;
+  size_t NameLen;
+  LLVMTypeRef FunctionTy;
+};
+
+// Declares a whole batch of functions in one call, writing the resulting
+// values to `ValuesOut` (which must hold `Len` entries) in input order.
+// Generated modules routinely declare tens of thousands of external
+// symbols, and doing the symbol-table probes in one tight loop here is
+// much cheaper than one FFI round trip per declaration.
+extern "C" void LLVMRustGetOrInsertFunctions(LLVMModuleRef M,
+                                             const LLVMRustFunctionDecl *Decls,
+                                             size_t Len,
+                                             LLVMValueRef *ValuesOut) {
+  Module *Mod = unwrap(M);
+  for (size_t I = 0; I < Len; I++) {
+    ValuesOut[I] = wrap(
+        Mod->getOrInsertFunction(StringRef(Decls[I].Name, Decls[I].NameLen),
+                                 unwrap<FunctionType>(Decls[I].FunctionTy))
+            .getCallee());
+  }
+}
+
 extern "C" LLVMValueRef
 LLVMRustGetOrInsertGlobal(LLVMModuleRef M, const char *Name, size_t NameLen, LLVMTypeRef Ty) {
   Module *Mod = unwrap(M);
@@ -267,6 +347,43 @@ extern "C" void LLVMRustAddCallSiteAttributes(LLVMValueRef Instr, unsigned Index
   AddAttributes(Call, Index, Attrs, AttrsLen);
 }
 
+// A prebuilt attribute set rustc constructs once and applies to many
+// functions. The individual attributes are already uniqued inside the
+// LLVMContext, so the handle's job is to make *application* cheap: one FFI
+// call covers a whole array of functions, and the AttrBuilder is rebuilt
+// from the uniqued set once per batch instead of once per function.
+struct LLVMRustAttributeSet {
+  AttributeSet AS;
+};
+
+extern "C" LLVMRustAttributeSet *
+LLVMRustAttributeSetCreate(LLVMContextRef C, LLVMAttributeRef *Attrs,
+                           size_t AttrsLen) {
+  AttrBuilder B(*unwrap(C));
+  for (LLVMAttributeRef Attr : ArrayRef<LLVMAttributeRef>(Attrs, AttrsLen))
+    B.addAttribute(unwrap(Attr));
+  return new LLVMRustAttributeSet{AttributeSet::get(*unwrap(C), B)};
+}
+
+extern "C" void LLVMRustAttributeSetFree(LLVMRustAttributeSet *Set) {
+  delete Set;
+}
+
+// Applies a prebuilt attribute set at `Index` to every function in `Fns`.
+// All functions must belong to the same context the set was created in.
+extern "C" void LLVMRustApplyAttributeSet(LLVMRustAttributeSet *Set,
+                                          unsigned Index, LLVMValueRef *Fns,
+                                          size_t NumFns) {
+  if (NumFns == 0)
+    return;
+  LLVMContext &C = unwrap<Function>(Fns[0])->getContext();
+  AttrBuilder B(C, Set->AS);
+  for (LLVMValueRef Fn : ArrayRef<LLVMValueRef>(Fns, NumFns)) {
+    Function *F = unwrap<Function>(Fn);
+    F->setAttributes(F->getAttributes().addAttributesAtIndex(C, Index, B));
+  }
+}
+
 extern "C" LLVMAttributeRef LLVMRustCreateAttrNoValue(LLVMContextRef C,
                                                       LLVMRustAttribute RustAttr) {
   return wrap(Attribute::get(*unwrap(C), fromRust(RustAttr)));
@@ -425,6 +542,18 @@ extern "C" void LLVMRustSetFastMath(LLVMValueRef V) {
   }
 }
 
+// Sets the builder's default fast-math flags: every float instruction
+// subsequently created through this builder inherits them, so a numeric
+// kernel pays one call per scope instead of one LLVMRustSetFastMath per
+// instruction. `Enable` uses the same all-flags set as setFast above;
+// false restores the IEEE-strict default.
+extern "C" void LLVMRustSetDefaultFastMath(LLVMBuilderRef B, bool Enable) {
+  FastMathFlags FMF;
+  if (Enable)
+    FMF.setFast(true);
+  unwrap(B)->setFastMathFlags(FMF);
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildAtomicLoad(LLVMBuilderRef B, LLVMTypeRef Ty, LLVMValueRef Source,
                         const char *Name, LLVMAtomicOrdering Order) {
@@ -471,18 +600,49 @@ LLVMRustInlineAsm(LLVMTypeRef Ty, char *AsmString, size_t AsmStringLen,
                              fromRust(Dialect), CanThrow));
 }
 
-extern "C" bool LLVMRustInlineAsmVerify(LLVMTypeRef Ty, char *Constraints,
-                                        size_t ConstraintsLen) {
+static bool verifyInlineAsm(FunctionType *FTy, StringRef Constraints) {
 #if LLVM_VERSION_LT(15, 0)
-  return InlineAsm::Verify(unwrap<FunctionType>(Ty),
-                           StringRef(Constraints, ConstraintsLen));
+  return InlineAsm::Verify(FTy, Constraints);
 #else
   // llvm::Error converts to true if it is an error.
-  return !llvm::errorToBool(InlineAsm::verify(
-      unwrap<FunctionType>(Ty), StringRef(Constraints, ConstraintsLen)));
+  return !llvm::errorToBool(InlineAsm::verify(FTy, Constraints));
 #endif
 }
 
+// Verification results are cached because monomorphization re-verifies the
+// same handful of macro-produced asm templates tens of thousands of times.
+// The key is the printed function type plus the constraint string - type
+// pointers can't be used because they only identify a type within one
+// LLVMContext's lifetime, while this cache outlives codegen contexts.
+// Rendering a signature is much cheaper than re-parsing the constraints.
+static struct {
+  std::mutex Lock;
+  StringMap<bool> Results;
+} InlineAsmVerifyCache;
+
+extern "C" bool LLVMRustInlineAsmVerify(LLVMTypeRef Ty, char *Constraints,
+                                        size_t ConstraintsLen) {
+  FunctionType *FTy = unwrap<FunctionType>(Ty);
+
+  SmallString<128> Key;
+  raw_svector_ostream KeyOS(Key);
+  FTy->print(KeyOS);
+  KeyOS << '\0' << StringRef(Constraints, ConstraintsLen);
+
+  {
+    std::lock_guard<std::mutex> Guard(InlineAsmVerifyCache.Lock);
+    auto It = InlineAsmVerifyCache.Results.find(Key);
+    if (It != InlineAsmVerifyCache.Results.end())
+      return It->second;
+  }
+
+  bool Valid = verifyInlineAsm(FTy, StringRef(Constraints, ConstraintsLen));
+
+  std::lock_guard<std::mutex> Guard(InlineAsmVerifyCache.Lock);
+  InlineAsmVerifyCache.Results[Key] = Valid;
+  return Valid;
+}
+
 typedef DIBuilder *LLVMRustDIBuilderRef;
 
 template <typename DIT> DIT *unwrapDIPtr(LLVMMetadataRef Ref) {
@@ -751,11 +911,47 @@ extern "C" bool LLVMRustHasModuleFlag(LLVMModuleRef M, const char *Name,
   return unwrap(M)->getModuleFlag(StringRef(Name, Len)) != nullptr;
 }
 
+struct LLVMRustModuleFlag {
+  Module::ModFlagBehavior MergeBehavior;
+  const char *Name;
+  uint32_t Value;
+};
+
+// Applies a whole array of module flags in one call. Every module gets the
+// same set of flags (debug-info version, PIC level, CFI, split-dwarf, ...)
+// at creation, and with hundreds of CGUs the per-flag FFI calls add up.
+extern "C" void LLVMRustAddModuleFlags(LLVMModuleRef M,
+                                       const LLVMRustModuleFlag *Flags,
+                                       size_t Len) {
+  Module *Mod = unwrap(M);
+  for (size_t I = 0; I < Len; I++) {
+    Mod->addModuleFlag(Flags[I].MergeBehavior, Flags[I].Name, Flags[I].Value);
+  }
+}
+
 extern "C" void LLVMRustGlobalAddMetadata(
     LLVMValueRef Global, unsigned Kind, LLVMMetadataRef MD) {
   unwrap<GlobalObject>(Global)->addMetadata(Kind, *unwrap<MDNode>(MD));
 }
 
+// One attachment in a LLVMRustGlobalsAddMetadata batch.
+struct LLVMRustGlobalMetadata {
+  LLVMValueRef Global;
+  unsigned Kind;
+  LLVMMetadataRef MD;
+};
+
+// Batch form of LLVMRustGlobalAddMetadata, in the same spirit as
+// LLVMRustAddFunctionAttributes taking an attribute array: all of a
+// module's debug/sanitizer metadata attachments go through one call
+// instead of one FFI crossing per (global, node) pair.
+extern "C" void LLVMRustGlobalsAddMetadata(
+    const LLVMRustGlobalMetadata *Attachments, size_t Len) {
+  for (const auto &A : ArrayRef<LLVMRustGlobalMetadata>(Attachments, Len)) {
+    unwrap<GlobalObject>(A.Global)->addMetadata(A.Kind, *unwrap<MDNode>(A.MD));
+  }
+}
+
 extern "C" LLVMRustDIBuilderRef LLVMRustDIBuilderCreate(LLVMModuleRef M) {
   return new DIBuilder(*unwrap(M));
 }
@@ -768,6 +964,18 @@ extern "C" void LLVMRustDIBuilderFinalize(LLVMRustDIBuilderRef Builder) {
   Builder->finalize();
 }
 
+// Finalizes a single subprogram's debug info as soon as its codegen is
+// done, instead of leaving all resolution to the whole-module finalize at
+// the end. Spreading the work across codegen shrinks the serial tail; the
+// module finalize still runs last to pick up retained types and anything
+// not attached to a subprogram. This can't be parallelized further:
+// resolving nodes creates uniqued metadata, which mutates the context's
+// uniquing tables.
+extern "C" void LLVMRustDIBuilderFinalizeSubprogram(LLVMRustDIBuilderRef Builder,
+                                                    LLVMMetadataRef SP) {
+  Builder->finalizeSubprogram(unwrapDIPtr<DISubprogram>(SP));
+}
+
 extern "C" LLVMMetadataRef LLVMRustDIBuilderCreateCompileUnit(
     LLVMRustDIBuilderRef Builder, unsigned Lang, LLVMMetadataRef FileRef,
     const char *Producer, size_t ProducerLen, bool isOptimized,
@@ -807,6 +1015,56 @@ extern "C" LLVMMetadataRef LLVMRustDIBuilderCreateFile(
                                   CSInfo));
 }
 
+// A session-level table of source files and their checksums. Hashing a
+// source file is work per *file*, but rustc redoes it (and re-sends the
+// result over FFI) once per CGU that references the file - 200+ times for a
+// popular header-like module in a big debug build. Instead the file is
+// registered once per session and later CGUs refer to it by id. The DIFile
+// node itself still has to be created per DIBuilder - metadata is owned by
+// one LLVMContext and can't be shared across modules - but creating it from
+// the table is a single indexed lookup, and LLVM uniques the node within
+// each context.
+struct LLVMRustSourceFile {
+  std::string Filename;
+  std::string Directory;
+  LLVMRustChecksumKind CSKind;
+  std::string Checksum;
+};
+
+static struct {
+  std::mutex Lock;
+  std::vector<LLVMRustSourceFile> Files;
+} SourceFileTable;
+
+extern "C" size_t LLVMRustSourceFileTableAdd(
+    const char *Filename, size_t FilenameLen, const char *Directory,
+    size_t DirectoryLen, LLVMRustChecksumKind CSKind, const char *Checksum,
+    size_t ChecksumLen) {
+  std::lock_guard<std::mutex> Guard(SourceFileTable.Lock);
+  SourceFileTable.Files.push_back({std::string(Filename, FilenameLen),
+                                   std::string(Directory, DirectoryLen),
+                                   CSKind,
+                                   std::string(Checksum, ChecksumLen)});
+  return SourceFileTable.Files.size() - 1;
+}
+
+extern "C" void LLVMRustSourceFileTableClear() {
+  std::lock_guard<std::mutex> Guard(SourceFileTable.Lock);
+  SourceFileTable.Files.clear();
+}
+
+// Creates the DIFile for a registered source file in this builder's context.
+extern "C" LLVMMetadataRef
+LLVMRustDIBuilderCreateFileFromTable(LLVMRustDIBuilderRef Builder,
+                                     size_t FileId) {
+  std::lock_guard<std::mutex> Guard(SourceFileTable.Lock);
+  const LLVMRustSourceFile &File = SourceFileTable.Files[FileId];
+  return LLVMRustDIBuilderCreateFile(
+      Builder, File.Filename.data(), File.Filename.size(),
+      File.Directory.data(), File.Directory.size(), File.CSKind,
+      File.Checksum.data(), File.Checksum.size());
+}
+
 extern "C" LLVMMetadataRef
 LLVMRustDIBuilderCreateSubroutineType(LLVMRustDIBuilderRef Builder,
                                       LLVMMetadataRef ParameterTypes) {
@@ -926,6 +1184,55 @@ extern "C" LLVMMetadataRef LLVMRustDIBuilderCreateMemberType(
                                         fromRust(Flags), unwrapDI<DIType>(Ty)));
 }
 
+// One member record of LLVMRustDIBuilderCreateStructTypeWithMembers. The
+// member's scope is always the struct being created, so it is not part of
+// the record.
+struct LLVMRustDIBuilderMember {
+  const char *Name;
+  size_t NameLen;
+  LLVMMetadataRef File;
+  unsigned LineNo;
+  uint64_t SizeInBits;
+  uint32_t AlignInBits;
+  uint64_t OffsetInBits;
+  LLVMRustDIFlags Flags;
+  LLVMMetadataRef Ty;
+};
+
+// Creates a struct type together with all of its members in one call,
+// instead of one FFI round trip per metadata node. The struct is created
+// first with an empty element list, the members are created with it as
+// their scope, and the element array is patched in afterwards.
+extern "C" LLVMMetadataRef LLVMRustDIBuilderCreateStructTypeWithMembers(
+    LLVMRustDIBuilderRef Builder, LLVMMetadataRef Scope,
+    const char *Name, size_t NameLen,
+    LLVMMetadataRef File, unsigned LineNumber, uint64_t SizeInBits,
+    uint32_t AlignInBits, LLVMRustDIFlags Flags,
+    LLVMMetadataRef DerivedFrom,
+    const LLVMRustDIBuilderMember *Members, size_t NumMembers,
+    unsigned RunTimeLang, LLVMMetadataRef VTableHolder,
+    const char *UniqueId, size_t UniqueIdLen) {
+  DICompositeType *StructTy = Builder->createStructType(
+      unwrapDI<DIDescriptor>(Scope), StringRef(Name, NameLen),
+      unwrapDI<DIFile>(File), LineNumber,
+      SizeInBits, AlignInBits, fromRust(Flags), unwrapDI<DIType>(DerivedFrom),
+      DINodeArray(), RunTimeLang,
+      unwrapDI<DIType>(VTableHolder), StringRef(UniqueId, UniqueIdLen));
+
+  SmallVector<Metadata *, 16> Elements;
+  Elements.reserve(NumMembers);
+  for (size_t I = 0; I < NumMembers; I++) {
+    const LLVMRustDIBuilderMember &M = Members[I];
+    Elements.push_back(Builder->createMemberType(
+        StructTy, StringRef(M.Name, M.NameLen), unwrapDI<DIFile>(M.File),
+        M.LineNo, M.SizeInBits, M.AlignInBits, M.OffsetInBits,
+        fromRust(M.Flags), unwrapDI<DIType>(M.Ty)));
+  }
+
+  Builder->replaceArrays(StructTy, Builder->getOrCreateArray(Elements));
+  return wrap(StructTy);
+}
+
 extern "C" LLVMMetadataRef LLVMRustDIBuilderCreateVariantMemberType(
     LLVMRustDIBuilderRef Builder, LLVMMetadataRef Scope,
     const char *Name, size_t NameLen, LLVMMetadataRef File, unsigned LineNo,
@@ -1168,6 +1475,30 @@ extern "C" void LLVMRustWriteValueToString(LLVMValueRef V,
   }
 }
 
+// Variants of the printers above using the inline small-string protocol
+// (see LLVMRustInlineString in LLVMWrapper.h). Type and value renderings
+// are usually a few dozen bytes, so the common case fills the caller's
+// inline buffer with no callback and no heap allocation.
+extern "C" void LLVMRustWriteTypeToInlineString(LLVMTypeRef Ty,
+                                                LLVMRustInlineString *Str) {
+  RawRustInlineStringOstream OS(Str);
+  unwrap<llvm::Type>(Ty)->print(OS);
+}
+
+extern "C" void LLVMRustWriteValueToInlineString(LLVMValueRef V,
+                                                 LLVMRustInlineString *Str) {
+  RawRustInlineStringOstream OS(Str);
+  if (!V) {
+    OS << "(null)";
+  } else {
+    OS << "(";
+    unwrap<llvm::Value>(V)->getType()->print(OS);
+    OS << ":";
+    unwrap<llvm::Value>(V)->print(OS);
+    OS << ")";
+  }
+}
+
 // LLVMArrayType function does not support 64-bit ElementCount
 // FIXME: replace with LLVMArrayType2 when bumped minimal version to llvm-17
 // https://github.com/llvm/llvm-project/commit/35276f16e5a2cae0dfb49c0fbf874d4d2f177acc
@@ -1207,6 +1538,88 @@ extern "C" void LLVMRustUnpackOptimizationDiagnostic(
   MessageOS << Opt->getMsg();
 }
 
+// Borrowed view of an optimization diagnostic, for handlers that see far
+// more remarks than they keep (e.g. -Cremark with a pass filter). The
+// string fields alias storage owned by LLVM - static pass-name tables and
+// the DIFile behind the debug location - and are only valid for the
+// duration of the diagnostic handler invocation. The message is *not* part
+// of the view: DiagnosticInfoOptimizationBase composes it from its argument
+// list on demand, so there is nothing to borrow; callers fetch it via
+// LLVMRustGetOptimizationDiagnosticMessage only for remarks they decide to
+// keep.
+//
+// IdentityHash is a stable xxHash64 of (pass name, remark name, function
+// name, location), suitable for deduplicating the remark stream on the Rust
+// side before any copying happens. Argument values are deliberately not
+// hashed: two emissions of the same remark at the same location count as
+// duplicates even if a cost value differs.
+struct LLVMRustOptimizationDiagnosticView {
+  const char *PassNamePtr;
+  size_t PassNameLen;
+  const char *RemarkNamePtr;
+  size_t RemarkNameLen;
+  // The path as recorded in the debug info, relative to the compilation
+  // directory; the copying unpacker returns the absolute path instead.
+  const char *FilenamePtr;
+  size_t FilenameLen;
+  LLVMValueRef Function;
+  unsigned Line;
+  unsigned Column;
+  bool HasLoc;
+  uint64_t IdentityHash;
+};
+
+extern "C" void
+LLVMRustBorrowOptimizationDiagnostic(LLVMDiagnosticInfoRef DI,
+                                     LLVMRustOptimizationDiagnosticView *View) {
+  // Undefined to call this not on an optimization diagnostic!
+  llvm::DiagnosticInfoOptimizationBase *Opt =
+      static_cast<llvm::DiagnosticInfoOptimizationBase *>(unwrap(DI));
+
+  StringRef PassName = Opt->getPassName();
+  StringRef RemarkName = Opt->getRemarkName();
+  View->PassNamePtr = PassName.data();
+  View->PassNameLen = PassName.size();
+  View->RemarkNamePtr = RemarkName.data();
+  View->RemarkNameLen = RemarkName.size();
+  View->Function = wrap(&Opt->getFunction());
+
+  StringRef Filename;
+  View->Line = 0;
+  View->Column = 0;
+  DiagnosticLocation Loc = Opt->getLocation();
+  View->HasLoc = Loc.isValid();
+  if (View->HasLoc) {
+    View->Line = Loc.getLine();
+    View->Column = Loc.getColumn();
+    Filename = Loc.getRelativePath();
+  }
+  View->FilenamePtr = Filename.data();
+  View->FilenameLen = Filename.size();
+
+  SmallString<256> IdentityKey;
+  IdentityKey.append(PassName);
+  IdentityKey.push_back('\0');
+  IdentityKey.append(RemarkName);
+  IdentityKey.push_back('\0');
+  IdentityKey.append(Opt->getFunction().getName());
+  IdentityKey.push_back('\0');
+  IdentityKey.append(Filename);
+  raw_svector_ostream(IdentityKey) << ':' << View->Line << ':' << View->Column;
+  View->IdentityHash = xxHash64(IdentityKey);
+}
+
+extern "C" void
+LLVMRustGetOptimizationDiagnosticMessage(LLVMDiagnosticInfoRef DI,
+                                         RustStringRef MessageOut) {
+  // Undefined to call this not on an optimization diagnostic!
+  llvm::DiagnosticInfoOptimizationBase *Opt =
+      static_cast<llvm::DiagnosticInfoOptimizationBase *>(unwrap(DI));
+
+  RawRustStringOstream MessageOS(MessageOut);
+  MessageOS << Opt->getMsg();
+}
+
 enum class LLVMRustDiagnosticLevel {
     Error,
     Warning,
@@ -1426,6 +1839,75 @@ extern "C" bool LLVMRustUnpackSMDiagnostic(LLVMSMDiagnosticRef DRef,
   return true;
 }
 
+// Borrowed view of an SMDiagnostic. The message and source-buffer slices
+// point into memory owned by the diagnostic and its SourceMgr, so they are
+// only valid for the duration of the diagnostic handler invocation that
+// received the SMDiagnosticRef.
+struct LLVMRustSMDiagnosticView {
+  const char *MessagePtr;
+  size_t MessageLen;
+  const char *BufferPtr;
+  size_t BufferLen;
+  LLVMRustDiagnosticLevel Level;
+  unsigned Loc;
+  bool HasLoc;
+};
+
+// Zero-copy variant of LLVMRustUnpackSMDiagnostic. Inline-asm diagnostics
+// arrive by the thousands on machine-generated asm and most are
+// deduplicated away before display, so this hands out borrowed slices and
+// lets rustc copy only the diagnostics it actually shows. Ranges are
+// filled like in the copying variant; `NumRanges` is in/out.
+extern "C" void LLVMRustBorrowSMDiagnostic(LLVMSMDiagnosticRef DRef,
+                                           LLVMRustSMDiagnosticView *ViewOut,
+                                           unsigned *RangesOut,
+                                           size_t *NumRanges) {
+  SMDiagnostic &D = *unwrap(DRef);
+  ViewOut->MessagePtr = D.getMessage().data();
+  ViewOut->MessageLen = D.getMessage().size();
+  ViewOut->BufferPtr = nullptr;
+  ViewOut->BufferLen = 0;
+  ViewOut->Loc = 0;
+  ViewOut->HasLoc = false;
+
+  switch (D.getKind()) {
+    case SourceMgr::DK_Error:
+      ViewOut->Level = LLVMRustDiagnosticLevel::Error;
+      break;
+    case SourceMgr::DK_Warning:
+      ViewOut->Level = LLVMRustDiagnosticLevel::Warning;
+      break;
+    case SourceMgr::DK_Note:
+      ViewOut->Level = LLVMRustDiagnosticLevel::Note;
+      break;
+    case SourceMgr::DK_Remark:
+      ViewOut->Level = LLVMRustDiagnosticLevel::Remark;
+      break;
+    default:
+      report_fatal_error("Invalid LLVMRustDiagnosticLevel value!");
+  }
+
+  if (D.getLoc() == SMLoc()) {
+    *NumRanges = 0;
+    return;
+  }
+
+  const SourceMgr &LSM = *D.getSourceMgr();
+  const MemoryBuffer *LBuf =
+      LSM.getMemoryBuffer(LSM.FindBufferContainingLoc(D.getLoc()));
+  ViewOut->BufferPtr = LBuf->getBufferStart();
+  ViewOut->BufferLen = LBuf->getBufferSize();
+  ViewOut->Loc = D.getLoc().getPointer() - LBuf->getBufferStart();
+  ViewOut->HasLoc = true;
+
+  *NumRanges = std::min(*NumRanges, D.getRanges().size());
+  size_t LineStart = ViewOut->Loc - (size_t)D.getColumnNo();
+  for (size_t i = 0; i < *NumRanges; i++) {
+    RangesOut[i * 2] = LineStart + D.getRanges()[i].first;
+    RangesOut[i * 2 + 1] = LineStart + D.getRanges()[i].second;
+  }
+}
+
 extern "C" OperandBundleDef *LLVMRustBuildOperandBundleDef(const char *Name,
                                                            LLVMValueRef *Inputs,
                                                            unsigned NumInputs) {
@@ -1436,6 +1918,87 @@ extern "C" void LLVMRustFreeOperandBundleDef(OperandBundleDef *Bundle) {
   delete Bundle;
 }
 
+std::atomic<bool> LLVMRustWrapperStatsEnabled(false);
+
+// Head of the registration list. Entries are function-local statics that
+// live forever, so the list only ever grows and the dump can walk it
+// without locking.
+static std::atomic<LLVMRustWrapperStatsEntry *> WrapperStatsHead(nullptr);
+
+LLVMRustWrapperStatsEntry::LLVMRustWrapperStatsEntry(const char *Name)
+    : Name(Name), Next(nullptr) {
+  LLVMRustWrapperStatsEntry *Head =
+      WrapperStatsHead.load(std::memory_order_relaxed);
+  do {
+    Next = Head;
+  } while (!WrapperStatsHead.compare_exchange_weak(
+      Head, this, std::memory_order_release, std::memory_order_relaxed));
+}
+
+extern "C" void LLVMRustWrapperStatsEnable(bool Enable) {
+  LLVMRustWrapperStatsEnabled.store(Enable, std::memory_order_relaxed);
+}
+
+// Writes one JSON object per instrumented entry point into `StatsOut`:
+// {"name": ..., "calls": ..., "latency_us_log2_buckets": [...]}, where
+// bucket N counts calls that took [2^(N-1), 2^N) microseconds (bucket 0 is
+// sub-microsecond). Counters keep accumulating afterwards; concurrent calls
+// may or may not be included, which is fine for a profiling dump.
+extern "C" void LLVMRustDumpWrapperStats(RustStringRef StatsOut) {
+  RawRustStringOstream OS(StatsOut);
+  json::OStream J(OS);
+  J.arrayBegin();
+  for (LLVMRustWrapperStatsEntry *Entry =
+           WrapperStatsHead.load(std::memory_order_acquire);
+       Entry; Entry = Entry->Next) {
+    J.objectBegin();
+    J.attribute("name", Entry->Name);
+    J.attribute("calls",
+                int64_t(Entry->Calls.load(std::memory_order_relaxed)));
+    J.attributeBegin("latency_us_log2_buckets");
+    J.arrayBegin();
+    for (unsigned i = 0; i < LLVMRustWrapperStatsEntry::NumBuckets; i++)
+      J.value(int64_t(Entry->Buckets[i].load(std::memory_order_relaxed)));
+    J.arrayEnd();
+    J.attributeEnd();
+    J.objectEnd();
+  }
+  J.arrayEnd();
+}
+
+// Pins the calling thread to one CPU. This is the primitive NUMA-aware
+// scheduling is built from on the Rust side: rustc owns the codegen worker
+// threads, so it can pin each worker to a node's CPUs and rely on
+// first-touch placement to keep a module's context, buffers and worker on
+// the same node - the wrapper's internal pools inherit locality the same
+// way, since each job allocates on the thread that runs it. Returns false
+// on platforms without an affinity syscall or if the call is rejected.
+extern "C" bool LLVMRustPinCurrentThreadToCpu(uint32_t Cpu) {
+#if defined(__linux__)
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  CPU_SET(Cpu, &Set);
+  return sched_setaffinity(0, sizeof(Set), &Set) == 0;
+#else
+  (void)Cpu;
+  return false;
+#endif
+}
+
+extern "C" LLVMRustArena *LLVMRustArenaCreate() { return new LLVMRustArena; }
+
+extern "C" void LLVMRustArenaFree(LLVMRustArena *Arena) { delete Arena; }
+
+// Like LLVMRustBuildOperandBundleDef, but the bundle lives in `Arena` and is
+// released with it; do not pass the result to LLVMRustFreeOperandBundleDef.
+extern "C" OperandBundleDef *
+LLVMRustBuildOperandBundleDefInArena(LLVMRustArena *Arena, const char *Name,
+                                     LLVMValueRef *Inputs,
+                                     unsigned NumInputs) {
+  return Arena->create<OperandBundleDef>(
+      Name, ArrayRef<Value *>(unwrap(Inputs), NumInputs));
+}
+
 extern "C" LLVMValueRef LLVMRustBuildCall(LLVMBuilderRef B, LLVMTypeRef Ty, LLVMValueRef Fn,
                                           LLVMValueRef *Args, unsigned NumArgs,
                                           OperandBundleDef **OpBundles,
@@ -1510,6 +2073,31 @@ extern "C" void LLVMRustSetComdat(LLVMModuleRef M, LLVMValueRef V,
   }
 }
 
+// Batch form of LLVMRustSetComdat: assigns Names[i] as the comdat of Vs[i]
+// for the whole arrays in one call. The triple is parsed and the COMDAT
+// support check done once, and a repeated name (common when rustc emits a
+// global and its associated data back to back) reuses the previous
+// comdat-table lookup instead of re-hashing the key.
+extern "C" void LLVMRustSetComdats(LLVMModuleRef M, LLVMValueRef *Vs,
+                                   const char *const *Names,
+                                   const size_t *NameLens, size_t Num) {
+  Module *Mod = unwrap(M);
+  Triple TargetTriple(Mod->getTargetTriple());
+  if (!TargetTriple.supportsCOMDAT())
+    return;
+
+  StringRef LastName;
+  Comdat *LastComdat = nullptr;
+  for (size_t i = 0; i < Num; i++) {
+    StringRef NameRef(Names[i], NameLens[i]);
+    if (!LastComdat || NameRef != LastName) {
+      LastComdat = Mod->getOrInsertComdat(NameRef);
+      LastName = LastComdat->getName();
+    }
+    unwrap<GlobalObject>(Vs[i])->setComdat(LastComdat);
+  }
+}
+
 enum class LLVMRustLinkage {
   ExternalLinkage = 0,
   AvailableExternallyLinkage = 1,
@@ -1601,6 +2189,59 @@ extern "C" LLVMValueRef LLVMRustConstInBoundsGEP2(LLVMTypeRef Ty,
   return wrap(ConstantExpr::getInBoundsGetElementPtr(unwrap(Ty), Val, IdxList));
 }
 
+// One relocation inside a byte-serialized initializer: the pointer-sized
+// hole at `Offset` is filled with `Pointer` (any pointer-typed constant)
+// instead of the raw bytes stored there.
+struct LLVMRustConstReloc {
+  uint64_t Offset;
+  LLVMValueRef Pointer;
+};
+
+// Materializes a whole aggregate initializer from its byte image in one
+// call: runs of plain data become i8 ConstantDataArrays, each relocation
+// becomes its pointer constant, and the pieces are glued together as an
+// anonymous packed struct. Large generated tables otherwise cost one FFI
+// crossing per element through the per-constant entry points, which makes
+// static-data-heavy codegen call-bound; this makes it one call per table.
+// Relocations must be sorted by offset, non-overlapping and inside the
+// image; returns null and sets the last error otherwise.
+extern "C" LLVMValueRef LLVMRustConstBytesWithRelocs(
+    LLVMModuleRef M, const char *Bytes, size_t Len,
+    const LLVMRustConstReloc *Relocs, size_t NumRelocs) {
+  Module *Mod = unwrap(M);
+  LLVMContext &Ctx = Mod->getContext();
+  const DataLayout &DL = Mod->getDataLayout();
+
+  SmallVector<Constant *, 16> Pieces;
+  uint64_t Pos = 0;
+  auto PushBytes = [&](uint64_t From, uint64_t To) {
+    if (From == To)
+      return;
+    Pieces.push_back(ConstantDataArray::getRaw(
+        StringRef(Bytes + From, To - From), To - From, Type::getInt8Ty(Ctx)));
+  };
+
+  for (size_t I = 0; I < NumRelocs; I++) {
+    Constant *Ptr = unwrap<Constant>(Relocs[I].Pointer);
+    if (!Ptr->getType()->isPointerTy()) {
+      LLVMRustSetLastError("relocation target is not pointer-typed");
+      return nullptr;
+    }
+    uint64_t PtrSize = DL.getTypeStoreSize(Ptr->getType());
+    if (Relocs[I].Offset < Pos || Relocs[I].Offset + PtrSize > Len) {
+      LLVMRustSetLastError(
+          "relocations must be sorted, non-overlapping and inside the image");
+      return nullptr;
+    }
+    PushBytes(Pos, Relocs[I].Offset);
+    Pieces.push_back(Ptr);
+    Pos = Relocs[I].Offset + PtrSize;
+  }
+  PushBytes(Pos, Len);
+
+  return wrap(ConstantStruct::getAnon(Ctx, Pieces, /*Packed=*/true));
+}
+
 extern "C" bool LLVMRustConstIntGetZExtValue(LLVMValueRef CV, uint64_t *value) {
     auto C = unwrap<llvm::ConstantInt>(CV);
     if (C->getBitWidth() > 64)
@@ -1792,15 +2433,9 @@ struct LLVMRustCOFFShortExport {
   uint16_t ordinal;
 };
 
-// Machine must be a COFF machine type, as defined in PE specs.
-extern "C" LLVMRustResult LLVMRustWriteImportLibrary(
-  const char* ImportName,
-  const char* Path,
-  const LLVMRustCOFFShortExport* Exports,
-  size_t NumExports,
-  uint16_t Machine,
-  bool MinGW)
-{
+static std::vector<llvm::object::COFFShortExport>
+convertCOFFShortExports(const LLVMRustCOFFShortExport *Exports,
+                        size_t NumExports) {
   std::vector<llvm::object::COFFShortExport> ConvertedExports;
   ConvertedExports.reserve(NumExports);
 
@@ -1820,6 +2455,20 @@ extern "C" LLVMRustResult LLVMRustWriteImportLibrary(
     });
   }
 
+  return ConvertedExports;
+}
+
+// Machine must be a COFF machine type, as defined in PE specs.
+extern "C" LLVMRustResult LLVMRustWriteImportLibrary(
+  const char* ImportName,
+  const char* Path,
+  const LLVMRustCOFFShortExport* Exports,
+  size_t NumExports,
+  uint16_t Machine,
+  bool MinGW)
+{
+  auto ConvertedExports = convertCOFFShortExports(Exports, NumExports);
+
   auto Error = llvm::object::writeImportLibrary(
     ImportName,
     Path,
@@ -1838,6 +2487,77 @@ extern "C" LLVMRustResult LLVMRustWriteImportLibrary(
   }
 }
 
+struct LLVMRustImportLibraryBuffer {
+  std::string data;
+};
+
+// Like LLVMRustWriteImportLibrary, but hands the generated library back as
+// an owned buffer (mirroring LLVMRustModuleBuffer) so the caller doesn't
+// have to manage a temp file and read it back just to embed the bytes into
+// an archive. LLVM's import library writer only exposes a write-to-path
+// entry point, so the temp file still exists transiently here; it is
+// created and cleaned up entirely inside this call. Returns null and sets
+// the last error on failure.
+extern "C" LLVMRustImportLibraryBuffer *LLVMRustWriteImportLibraryToBuffer(
+  const char* ImportName,
+  const LLVMRustCOFFShortExport* Exports,
+  size_t NumExports,
+  uint16_t Machine,
+  bool MinGW)
+{
+  auto ConvertedExports = convertCOFFShortExports(Exports, NumExports);
+
+  SmallString<128> Path;
+  if (std::error_code EC =
+          sys::fs::createTemporaryFile("rustc-import", "lib", Path)) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return nullptr;
+  }
+
+  auto Error = llvm::object::writeImportLibrary(
+    ImportName,
+    Path,
+    ConvertedExports,
+    static_cast<llvm::COFF::MachineTypes>(Machine),
+    MinGW);
+  if (Error) {
+    std::string errorString;
+    llvm::raw_string_ostream stream(errorString);
+    stream << Error;
+    stream.flush();
+    LLVMRustSetLastError(errorString.c_str());
+    sys::fs::remove(Path);
+    return nullptr;
+  }
+
+  auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+  sys::fs::remove(Path);
+  if (!BufOrErr) {
+    LLVMRustSetLastError(BufOrErr.getError().message().c_str());
+    return nullptr;
+  }
+
+  auto Ret = std::make_unique<LLVMRustImportLibraryBuffer>();
+  Ret->data.assign((*BufOrErr)->getBufferStart(), (*BufOrErr)->getBufferSize());
+  return Ret.release();
+}
+
+extern "C" void
+LLVMRustImportLibraryBufferFree(LLVMRustImportLibraryBuffer *Buffer) {
+  delete Buffer;
+}
+
+extern "C" const void*
+LLVMRustImportLibraryBufferPtr(const LLVMRustImportLibraryBuffer *Buffer) {
+  return Buffer->data.data();
+}
+
+extern "C" size_t
+LLVMRustImportLibraryBufferLen(const LLVMRustImportLibraryBuffer *Buffer) {
+  return Buffer->data.length();
+}
+
 // Transfers ownership of DiagnosticHandler unique_ptr to the caller.
 extern "C" DiagnosticHandler *
 LLVMRustContextGetDiagnosticHandler(LLVMContextRef C) {
@@ -1899,6 +2619,17 @@ extern "C" void LLVMRustContextConfigureDiagnosticHandler(
         }
       }
       if (DiagnosticHandlerCallback) {
+        // Filter out remarks from passes the user didn't ask for here,
+        // before any strings are formatted or the FFI boundary is crossed;
+        // with remarks enabled LLVM emits them for every pass. Warnings and
+        // errors that happen to derive from DiagnosticInfoOptimizationBase
+        // (e.g. optimization failures) are still forwarded.
+        if (DI.getSeverity() == DS_Remark) {
+          if (auto *OptDiagBase = dyn_cast<DiagnosticInfoOptimizationBase>(&DI)) {
+            if (!isRemarkEnabled(OptDiagBase->getPassName()))
+              return true;
+          }
+        }
         DiagnosticHandlerCallback(DI, DiagnosticHandlerContext);
         return true;
       }
@@ -1998,12 +2729,141 @@ extern "C" void LLVMRustContextConfigureDiagnosticHandler(
   ));
 }
 
+// Per-context diagnostic buffer, filled by the context's worker thread and
+// drained by the coordinating thread. The lock is held only for the append
+// or the drain's swap, so a worker in a remark storm appends to local
+// memory instead of waiting for the Rust side to serialize each callback.
+struct LLVMRustBufferedDiagnostics {
+  std::mutex Lock;
+  size_t Count = 0;
+  std::string Records; // level:u64le, msg_len:u64le, msg bytes
+};
+
+static DiagnosticSeverity fromRust(LLVMRustDiagnosticLevel Level) {
+  switch (Level) {
+  case LLVMRustDiagnosticLevel::Error:
+    return DS_Error;
+  case LLVMRustDiagnosticLevel::Warning:
+    return DS_Warning;
+  case LLVMRustDiagnosticLevel::Remark:
+    return DS_Remark;
+  case LLVMRustDiagnosticLevel::Note:
+    return DS_Note;
+  }
+  report_fatal_error("Invalid LLVMRustDiagnosticLevel value!");
+}
+
+static LLVMRustDiagnosticLevel toRust(DiagnosticSeverity Severity) {
+  switch (Severity) {
+  case DS_Error:
+    return LLVMRustDiagnosticLevel::Error;
+  case DS_Warning:
+    return LLVMRustDiagnosticLevel::Warning;
+  case DS_Remark:
+    return LLVMRustDiagnosticLevel::Remark;
+  case DS_Note:
+    return LLVMRustDiagnosticLevel::Note;
+  }
+  report_fatal_error("Invalid DiagnosticSeverity value!");
+}
+
+// Buffered alternative to LLVMRustContextConfigureDiagnosticHandler for
+// parallel LTO workers. Diagnostics less severe than `MinLevel` are
+// dropped before any string is formatted; the rest are printed into the
+// returned buffer on the worker thread and cross the FFI boundary only
+// when the coordinator drains them at a safe point, instead of one
+// callback (and one Rust-side lock acquisition) per diagnostic. The
+// buffer must outlive the context and is freed with
+// LLVMRustBufferedDiagnosticsFree.
+extern "C" LLVMRustBufferedDiagnostics *
+LLVMRustContextInstallBufferedDiagnosticHandler(
+    LLVMContextRef C, LLVMRustDiagnosticLevel MinLevel) {
+  class BufferedDiagnosticHandler final : public DiagnosticHandler {
+  public:
+    BufferedDiagnosticHandler(LLVMRustBufferedDiagnostics *Out,
+                              DiagnosticSeverity Threshold)
+        : Out(Out), Threshold(Threshold) {}
+
+    bool handleDiagnostics(const DiagnosticInfo &DI) override {
+      // DiagnosticSeverity orders most severe first, so anything numbered
+      // past the threshold is noise for this consumer.
+      if (DI.getSeverity() > Threshold)
+        return true;
+
+      SmallString<128> Msg;
+      raw_svector_ostream MsgOS(Msg);
+      DiagnosticPrinterRawOStream DP(MsgOS);
+      DI.print(DP);
+
+      char Buf[8];
+      std::lock_guard<std::mutex> Guard(Out->Lock);
+      support::endian::write64le(
+          Buf, static_cast<uint64_t>(toRust(DI.getSeverity())));
+      Out->Records.append(Buf, sizeof(Buf));
+      support::endian::write64le(Buf, Msg.size());
+      Out->Records.append(Buf, sizeof(Buf));
+      Out->Records.append(Msg.begin(), Msg.end());
+      Out->Count++;
+      return true;
+    }
+
+  private:
+    LLVMRustBufferedDiagnostics *Out;
+    DiagnosticSeverity Threshold;
+  };
+
+  auto Out = std::make_unique<LLVMRustBufferedDiagnostics>();
+  unwrap(C)->setDiagnosticHandler(std::make_unique<BufferedDiagnosticHandler>(
+      Out.get(), fromRust(MinLevel)));
+  return Out.release();
+}
+
+// Moves all buffered records into `Out` and returns how many there were.
+extern "C" size_t
+LLVMRustBufferedDiagnosticsDrain(LLVMRustBufferedDiagnostics *Q,
+                                 RustStringRef Out) {
+  std::string Records;
+  size_t Count;
+  {
+    std::lock_guard<std::mutex> Guard(Q->Lock);
+    Records = std::move(Q->Records);
+    Q->Records.clear();
+    Count = Q->Count;
+    Q->Count = 0;
+  }
+  RawRustStringOstream OS(Out);
+  OS.write(Records.data(), Records.size());
+  return Count;
+}
+
+extern "C" void
+LLVMRustBufferedDiagnosticsFree(LLVMRustBufferedDiagnostics *Q) {
+  delete Q;
+}
+
 extern "C" void LLVMRustGetMangledName(LLVMValueRef V, RustStringRef Str) {
   RawRustStringOstream OS(Str);
   GlobalValue *GV = unwrap<GlobalValue>(V);
   Mangler().getNameWithPrefix(OS, GV, true);
 }
 
+// Batch form of LLVMRustGetMangledName for symbol-map emission: mangles all
+// `NumVs` globals in one call, concatenating the names into `NamesOut` and
+// writing each name's byte length into `LensOut` so the caller can slice
+// the buffer apart. One Mangler serves the whole batch, keeping its
+// per-global cache warm across names.
+extern "C" void LLVMRustGetMangledNames(LLVMValueRef *Vs, size_t NumVs,
+                                        size_t *LensOut,
+                                        RustStringRef NamesOut) {
+  RawRustStringOstream OS(NamesOut);
+  Mangler M;
+  for (size_t i = 0; i < NumVs; i++) {
+    uint64_t Start = OS.tell();
+    M.getNameWithPrefix(OS, unwrap<GlobalValue>(Vs[i]), true);
+    LensOut[i] = OS.tell() - Start;
+  }
+}
+
 // LLVMGetAggregateElement was added in LLVM 15. For earlier LLVM versions just
 // use its implementation.
 #if LLVM_VERSION_LT(15, 0)
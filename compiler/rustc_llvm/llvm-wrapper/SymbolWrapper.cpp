@@ -7,8 +7,14 @@
 // * https://github.com/llvm/llvm-project/blob/8ef3e895ad8ab1724e2b87cabad1dacdc7a397a3/llvm/include/llvm/Object/ArchiveWriter.h
 // * https://github.com/llvm/llvm-project/blob/8ef3e895ad8ab1724e2b87cabad1dacdc7a397a3/llvm/lib/Object/ArchiveWriter.cpp
 
+#include <cstring>
+#include <vector>
+
+#include "LLVMWrapper.h"
+
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Endian.h"
 
 using namespace llvm;
 using namespace llvm::sys;
@@ -30,17 +36,20 @@ static bool isArchiveSymbol(const object::BasicSymbolRef &S) {
 
 typedef void *(*LLVMRustGetSymbolsCallback)(void *, const char *);
 typedef void *(*LLVMRustGetSymbolsErrorCallback)(const char *);
+// Like LLVMRustGetSymbolsCallback but with the index of the member the
+// symbol came from.
+typedef void *(*LLVMRustGetSymbolsMemberCallback)(void *, size_t, const char *);
 
-// Note: This is implemented in C++ instead of using the C api from Rust as IRObjectFile doesn't
-// implement getSymbolName, only printSymbolName, which is inaccessible from the C api.
-extern "C" void *LLVMRustGetSymbols(
-  char *BufPtr, size_t BufLen, void *State, LLVMRustGetSymbolsCallback Callback,
-  LLVMRustGetSymbolsErrorCallback ErrorCallback) {
+// Extracts all archive-relevant symbol names of one object buffer into
+// `SymNamesOut` as a sequence of NUL-terminated strings. On failure, fills
+// `ErrorOut` (NUL-terminated) instead and returns false.
+static bool getSymbolsFromObject(StringRef BufContents,
+                                 SmallVectorImpl<char> &SymNamesOut,
+                                 SmallVectorImpl<char> &ErrorOut) {
   std::unique_ptr<MemoryBuffer> Buf =
-    MemoryBuffer::getMemBuffer(StringRef(BufPtr, BufLen), StringRef("LLVMRustGetSymbolsObject"),
+    MemoryBuffer::getMemBuffer(BufContents, StringRef("LLVMRustGetSymbolsObject"),
                                false);
-  SmallString<0> SymNameBuf;
-  raw_svector_ostream SymName(SymNameBuf);
+  raw_svector_ostream SymNames(SymNamesOut);
 
   // In the scenario when LLVMContext is populated SymbolicFile will contain a
   // reference to it, thus SymbolicFile should be destroyed first.
@@ -49,7 +58,7 @@ extern "C" void *LLVMRustGetSymbols(
 
   const file_magic Type = identify_magic(Buf->getBuffer());
   if (!object::SymbolicFile::isSymbolicFile(Type, &Context)) {
-    return 0;
+    return true;
   }
 
   if (Type == file_magic::bitcode) {
@@ -57,20 +66,18 @@ extern "C" void *LLVMRustGetSymbols(
       Buf->getMemBufferRef(), file_magic::bitcode, &Context);
     if (!ObjOrErr) {
       Error E = ObjOrErr.takeError();
-      SmallString<0> ErrorBuf;
-      raw_svector_ostream Error(ErrorBuf);
+      raw_svector_ostream Error(ErrorOut);
       Error << E << '\0';
-      return ErrorCallback(Error.str().data());
+      return false;
     }
     Obj = std::move(*ObjOrErr);
   } else {
     auto ObjOrErr = object::SymbolicFile::createSymbolicFile(Buf->getMemBufferRef());
     if (!ObjOrErr) {
       Error E = ObjOrErr.takeError();
-      SmallString<0> ErrorBuf;
-      raw_svector_ostream Error(ErrorBuf);
+      raw_svector_ostream Error(ErrorOut);
       Error << E << '\0';
-      return ErrorCallback(Error.str().data());
+      return false;
     }
     Obj = std::move(*ObjOrErr);
   }
@@ -79,17 +86,143 @@ extern "C" void *LLVMRustGetSymbols(
   for (const object::BasicSymbolRef &S : Obj->symbols()) {
     if (!isArchiveSymbol(S))
       continue;
-    if (Error E = S.printName(SymName)) {
-      SmallString<0> ErrorBuf;
-      raw_svector_ostream Error(ErrorBuf);
+    if (Error E = S.printName(SymNames)) {
+      raw_svector_ostream Error(ErrorOut);
       Error << E << '\0';
-      return ErrorCallback(Error.str().data());
+      return false;
     }
-    SymName << '\0';
-    if (void *E = Callback(State, SymNameBuf.str().data())) {
+    SymNames << '\0';
+  }
+  return true;
+}
+
+// Note: This is implemented in C++ instead of using the C api from Rust as IRObjectFile doesn't
+// implement getSymbolName, only printSymbolName, which is inaccessible from the C api.
+extern "C" void *LLVMRustGetSymbols(
+  char *BufPtr, size_t BufLen, void *State, LLVMRustGetSymbolsCallback Callback,
+  LLVMRustGetSymbolsErrorCallback ErrorCallback) {
+  LLVM_RUST_TIME_ENTRY_POINT();
+  SmallString<0> SymNamesBuf;
+  SmallString<0> ErrorBuf;
+  if (!getSymbolsFromObject(StringRef(BufPtr, BufLen), SymNamesBuf, ErrorBuf))
+    return ErrorCallback(ErrorBuf.data());
+
+  for (const char *Name = SymNamesBuf.data(),
+                  *End = SymNamesBuf.data() + SymNamesBuf.size();
+       Name != End; Name += strlen(Name) + 1) {
+    if (void *E = Callback(State, Name))
       return E;
+  }
+  return 0;
+}
+
+static void writeU64LE(raw_ostream &OS, uint64_t Value) {
+  char Buf[8];
+  support::endian::write64le(Buf, Value);
+  OS.write(Buf, sizeof(Buf));
+}
+
+// Packed-buffer version of LLVMRustGetSymbols: instead of one callback per
+// symbol - an FFI crossing for each of the hundreds of symbols in a typical
+// object - every name is appended to `SymbolsOut` as a
+// `name_len:u64le, name bytes` record and handed back in one piece, making
+// symbol harvesting copy-bound rather than call-bound.
+extern "C" LLVMRustResult LLVMRustGetSymbolsPacked(char *BufPtr, size_t BufLen,
+                                                   RustStringRef SymbolsOut) {
+  LLVM_RUST_TIME_ENTRY_POINT();
+  SmallString<0> SymNamesBuf;
+  SmallString<0> ErrorBuf;
+  if (!getSymbolsFromObject(StringRef(BufPtr, BufLen), SymNamesBuf, ErrorBuf)) {
+    LLVMRustSetLastError(ErrorBuf.data());
+    return LLVMRustResult::Failure;
+  }
+
+  RawRustStringOstream OS(SymbolsOut);
+  for (const char *Name = SymNamesBuf.data(),
+                  *End = SymNamesBuf.data() + SymNamesBuf.size();
+       Name != End; Name += strlen(Name) + 1) {
+    size_t Len = strlen(Name);
+    writeU64LE(OS, Len);
+    OS.write(Name, Len);
+  }
+  return LLVMRustResult::Success;
+}
+
+// Packed-buffer version of LLVMRustGetSymbolsBatch. Extraction runs on a
+// thread pool; the output is written in member order as, per member, a
+// `num_symbols:u64le` header followed by that member's
+// `name_len:u64le, name bytes` records.
+extern "C" LLVMRustResult
+LLVMRustGetSymbolsBatchPacked(char *const *BufPtrs, const size_t *BufLens,
+                              size_t NumBufs, RustStringRef SymbolsOut) {
+  std::vector<SmallString<0>> SymNames(NumBufs);
+  std::vector<SmallString<0>> Errors(NumBufs);
+
+  WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
+  for (size_t I = 0; I < NumBufs; I++) {
+    Pool.async([&, I] {
+      getSymbolsFromObject(StringRef(BufPtrs[I], BufLens[I]), SymNames[I],
+                           Errors[I]);
+    });
+  }
+  Pool.wait();
+
+  for (size_t I = 0; I < NumBufs; I++) {
+    if (!Errors[I].empty()) {
+      LLVMRustSetLastError(Errors[I].data());
+      return LLVMRustResult::Failure;
+    }
+  }
+
+  RawRustStringOstream OS(SymbolsOut);
+  for (size_t I = 0; I < NumBufs; I++) {
+    uint64_t NumSymbols = 0;
+    for (const char *Name = SymNames[I].data(),
+                    *End = SymNames[I].data() + SymNames[I].size();
+         Name != End; Name += strlen(Name) + 1)
+      NumSymbols++;
+    writeU64LE(OS, NumSymbols);
+    for (const char *Name = SymNames[I].data(),
+                    *End = SymNames[I].data() + SymNames[I].size();
+         Name != End; Name += strlen(Name) + 1) {
+      size_t Len = strlen(Name);
+      writeU64LE(OS, Len);
+      OS.write(Name, Len);
+    }
+  }
+  return LLVMRustResult::Success;
+}
+
+// Batched version of LLVMRustGetSymbols: extracts the symbols of all member
+// buffers on a thread pool, then replays the results through `Callback` on
+// the calling thread, in member order, so the Rust side never sees concurrent
+// callbacks. Symbol extraction for a large rlib is otherwise single-core
+// bound.
+extern "C" void *LLVMRustGetSymbolsBatch(
+  char *const *BufPtrs, const size_t *BufLens, size_t NumBufs, void *State,
+  LLVMRustGetSymbolsMemberCallback Callback,
+  LLVMRustGetSymbolsErrorCallback ErrorCallback) {
+  std::vector<SmallString<0>> SymNames(NumBufs);
+  std::vector<SmallString<0>> Errors(NumBufs);
+
+  WrapperTaskGroup Pool(LLVMRustJobPriority::ThinLink);
+  for (size_t I = 0; I < NumBufs; I++) {
+    Pool.async([&, I] {
+      getSymbolsFromObject(StringRef(BufPtrs[I], BufLens[I]), SymNames[I],
+                           Errors[I]);
+    });
+  }
+  Pool.wait();
+
+  for (size_t I = 0; I < NumBufs; I++) {
+    if (!Errors[I].empty())
+      return ErrorCallback(Errors[I].data());
+    for (const char *Name = SymNames[I].data(),
+                    *End = SymNames[I].data() + SymNames[I].size();
+         Name != End; Name += strlen(Name) + 1) {
+      if (void *E = Callback(State, I, Name))
+        return E;
     }
-    SymNameBuf.clear();
   }
   return 0;
 }
@@ -0,0 +1,388 @@
+// Micro-benchmark driver for the llvm-wrapper's hot entry points. Links the
+// wrapper objects directly (see README.md) so a PassWrapper.cpp change can be
+// measured in minutes instead of through a full bootstrap.
+//
+// The FFI declarations below mirror the wrapper's extern "C" definitions; the
+// enums and structs must stay in sync with PassWrapper.cpp, SymbolWrapper.cpp
+// and ArchiveWrapper.cpp. This file also provides C++ stand-ins for the
+// helpers the wrapper normally gets from the Rust side.
+
+#include "llvm-c/BitReader.h"
+#include "llvm-c/Core.h"
+#include "llvm-c/TargetMachine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+typedef struct OpaqueRustString *RustStringRef;
+
+// ---------------------------------------------------------------------------
+// Stand-ins for the Rust-side helpers the wrapper objects reference. A
+// RustStringRef is just a std::string here.
+
+static std::string LastError;
+
+extern "C" void LLVMRustSetLastError(const char *Err) {
+  LastError = Err ? Err : "";
+}
+
+extern "C" void LLVMRustStringWriteImpl(RustStringRef Str, const char *Ptr,
+                                        size_t Size) {
+  reinterpret_cast<std::string *>(Str)->append(Ptr, Size);
+}
+
+extern "C" void LLVMRustStringReserveImpl(RustStringRef Str,
+                                          size_t Additional) {
+  std::string *S = reinterpret_cast<std::string *>(Str);
+  S->reserve(S->size() + Additional);
+}
+
+// ---------------------------------------------------------------------------
+// Mirrored wrapper declarations.
+
+enum class LLVMRustResult { Success, Failure };
+
+// Must match PassWrapper.cpp.
+enum class LLVMRustPassBuilderOptLevel { O0, O1, O2, O3, Os, Oz };
+enum class LLVMRustOptStage {
+  PreLinkNoLTO,
+  PreLinkThinLTO,
+  PreLinkFatLTO,
+  ThinLTO,
+  FatLTO,
+};
+struct LLVMRustSanitizerOptions;
+
+extern "C" typedef void (*LLVMRustSelfProfileBeforePassCallback)(
+    void *, const char *, const char *);
+extern "C" typedef void (*LLVMRustSelfProfileAfterPassCallback)(void *);
+
+extern "C" LLVMRustResult LLVMRustOptimize(
+    LLVMModuleRef ModuleRef, LLVMTargetMachineRef TMRef,
+    LLVMRustPassBuilderOptLevel OptLevelRust, LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize,
+    bool LoopVectorize, bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    LLVMRustSanitizerOptions *SanitizerOptions, const char *PGOGenPath,
+    const char *PGOUsePath, bool InstrumentCoverage,
+    const char *InstrProfileOutput, bool InstrumentGCOV,
+    const char *PGOSampleUsePath, bool DebugInfoForProfiling,
+    void *LlvmSelfProfiler,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const char *ExtraPasses, size_t ExtraPassesLen, const char *LLVMPlugins,
+    size_t LLVMPluginsLen);
+
+struct LLVMRustThinLTOBuffer;
+extern "C" LLVMRustThinLTOBuffer *LLVMRustThinLTOBufferCreate(LLVMModuleRef M,
+                                                              bool is_thin);
+extern "C" void LLVMRustThinLTOBufferFree(LLVMRustThinLTOBuffer *Buffer);
+extern "C" const void *
+LLVMRustThinLTOBufferPtr(const LLVMRustThinLTOBuffer *Buffer);
+extern "C" size_t LLVMRustThinLTOBufferLen(const LLVMRustThinLTOBuffer *Buffer);
+
+// Must match PassWrapper.cpp.
+struct LLVMRustThinLTOModule {
+  const char *identifier;
+  const char *data;
+  size_t len;
+};
+struct LLVMRustThinLTOData;
+extern "C" LLVMRustThinLTOData *
+LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules, int num_modules,
+                          const char **preserved_symbols, int num_symbols);
+extern "C" void LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data);
+
+typedef void *(*LLVMRustGetSymbolsCallback)(void *, const char *);
+typedef void *(*LLVMRustGetSymbolsErrorCallback)(const char *);
+extern "C" void *LLVMRustGetSymbols(char *BufPtr, size_t BufLen, void *State,
+                                    LLVMRustGetSymbolsCallback Callback,
+                                    LLVMRustGetSymbolsErrorCallback ErrorCb);
+
+// Must match ArchiveWrapper.cpp.
+enum class LLVMRustArchiveKind { GNU, BSD, DARWIN, COFF, AIX_BIG, GNU_THIN };
+struct RustArchiveMember;
+extern "C" RustArchiveMember *LLVMRustArchiveMemberNew(char *Filename,
+                                                       char *Name,
+                                                       void *Child);
+extern "C" void LLVMRustArchiveMemberFree(RustArchiveMember *Member);
+extern "C" LLVMRustResult
+LLVMRustWriteArchive(char *Dst, size_t NumMembers,
+                     RustArchiveMember *const *NewMembers, bool WriteSymbtab,
+                     LLVMRustArchiveKind Kind);
+
+// ---------------------------------------------------------------------------
+// Measurement.
+
+struct Samples {
+  std::vector<double> Millis;
+
+  void report(const char *Name) const {
+    std::vector<double> Sorted = Millis;
+    std::sort(Sorted.begin(), Sorted.end());
+    double Sum = 0;
+    for (double S : Sorted)
+      Sum += S;
+    double Mean = Sum / Sorted.size();
+    double Var = 0;
+    for (double S : Sorted)
+      Var += (S - Mean) * (S - Mean);
+    double StdDev = std::sqrt(Var / Sorted.size());
+    printf("%-12s n=%zu min=%.3fms median=%.3fms mean=%.3fms max=%.3fms "
+           "stddev=%.3fms\n",
+           Name, Sorted.size(), Sorted.front(), Sorted[Sorted.size() / 2],
+           Mean, Sorted.back(), StdDev);
+  }
+};
+
+template <typename Fn> static void measure(int Iters, Samples &Out, Fn Body) {
+  // One warmup iteration to populate caches and lazy state.
+  Body();
+  for (int i = 0; i < Iters; i++) {
+    auto Start = std::chrono::steady_clock::now();
+    Body();
+    auto End = std::chrono::steady_clock::now();
+    Out.Millis.push_back(
+        std::chrono::duration<double, std::milli>(End - Start).count());
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Input handling.
+
+struct InputFile {
+  std::string Path;
+  std::string Contents;
+};
+
+static bool readFile(const char *Path, InputFile &Out) {
+  FILE *F = fopen(Path, "rb");
+  if (!F) {
+    fprintf(stderr, "error: cannot open %s\n", Path);
+    return false;
+  }
+  char Buf[1 << 16];
+  size_t N;
+  while ((N = fread(Buf, 1, sizeof(Buf), F)) > 0)
+    Out.Contents.append(Buf, N);
+  fclose(F);
+  Out.Path = Path;
+  return true;
+}
+
+static LLVMModuleRef parseModule(LLVMContextRef Ctx, const InputFile &File) {
+  LLVMMemoryBufferRef MemBuf = LLVMCreateMemoryBufferWithMemoryRangeCopy(
+      File.Contents.data(), File.Contents.size(), File.Path.c_str());
+  LLVMModuleRef Mod = nullptr;
+  if (LLVMParseBitcodeInContext2(Ctx, MemBuf, &Mod)) {
+    fprintf(stderr, "error: cannot parse bitcode in %s\n", File.Path.c_str());
+    return nullptr;
+  }
+  return Mod;
+}
+
+static LLVMTargetMachineRef createHostTargetMachine() {
+  LLVMInitializeAllTargetInfos();
+  LLVMInitializeAllTargets();
+  LLVMInitializeAllTargetMCs();
+  LLVMInitializeAllAsmPrinters();
+  LLVMInitializeAllAsmParsers();
+  char *Triple = LLVMGetDefaultTargetTriple();
+  LLVMTargetRef Target = nullptr;
+  char *Err = nullptr;
+  if (LLVMGetTargetFromTriple(Triple, &Target, &Err)) {
+    fprintf(stderr, "error: %s\n", Err);
+    return nullptr;
+  }
+  LLVMTargetMachineRef TM = LLVMCreateTargetMachine(
+      Target, Triple, "", "", LLVMCodeGenLevelDefault, LLVMRelocDefault,
+      LLVMCodeModelDefault);
+  LLVMDisposeMessage(Triple);
+  return TM;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmarks. Each takes the raw input files and an iteration count.
+
+static int benchOptimize(const std::vector<InputFile> &Files, int Iters) {
+  LLVMTargetMachineRef TM = createHostTargetMachine();
+  if (!TM)
+    return 1;
+  Samples S;
+  measure(Iters, S, [&] {
+    for (const InputFile &File : Files) {
+      // The pipeline mutates the module, so each iteration re-parses. The
+      // thinlto-buf benchmark gives the parse-side baseline to subtract.
+      LLVMContextRef Ctx = LLVMContextCreate();
+      LLVMModuleRef Mod = parseModule(Ctx, File);
+      if (Mod) {
+        LLVMRustOptimize(Mod, TM, LLVMRustPassBuilderOptLevel::O2,
+                         LLVMRustOptStage::PreLinkNoLTO,
+                         /*NoPrepopulatePasses=*/false, /*VerifyIR=*/false,
+                         /*UseThinLTOBuffers=*/false, /*MergeFunctions=*/false,
+                         /*UnrollLoops=*/true, /*SLPVectorize=*/true,
+                         /*LoopVectorize=*/true,
+                         /*DisableSimplifyLibCalls=*/false,
+                         /*EmitLifetimeMarkers=*/true, nullptr, nullptr,
+                         nullptr, false, nullptr, false, nullptr, false,
+                         nullptr, nullptr, nullptr, "", 0, "", 0);
+        LLVMDisposeModule(Mod);
+      }
+      LLVMContextDispose(Ctx);
+    }
+  });
+  S.report("optimize");
+  return 0;
+}
+
+static int benchThinLTOBuffer(const std::vector<InputFile> &Files, int Iters) {
+  Samples S;
+  measure(Iters, S, [&] {
+    for (const InputFile &File : Files) {
+      LLVMContextRef Ctx = LLVMContextCreate();
+      LLVMModuleRef Mod = parseModule(Ctx, File);
+      if (Mod) {
+        LLVMRustThinLTOBuffer *Buf =
+            LLVMRustThinLTOBufferCreate(Mod, /*is_thin=*/true);
+        LLVMRustThinLTOBufferFree(Buf);
+        LLVMDisposeModule(Mod);
+      }
+      LLVMContextDispose(Ctx);
+    }
+  });
+  S.report("thinlto-buf");
+  return 0;
+}
+
+static int benchThinLTOIndex(const std::vector<InputFile> &Files, int Iters) {
+  // Build the summary-carrying buffers once; the benchmark measures only the
+  // combined-index analysis.
+  std::vector<LLVMRustThinLTOBuffer *> Buffers;
+  std::vector<LLVMRustThinLTOModule> Modules;
+  for (const InputFile &File : Files) {
+    LLVMContextRef Ctx = LLVMContextCreate();
+    LLVMModuleRef Mod = parseModule(Ctx, File);
+    if (!Mod) {
+      LLVMContextDispose(Ctx);
+      return 1;
+    }
+    LLVMRustThinLTOBuffer *Buf =
+        LLVMRustThinLTOBufferCreate(Mod, /*is_thin=*/true);
+    Buffers.push_back(Buf);
+    Modules.push_back({File.Path.c_str(),
+                       static_cast<const char *>(LLVMRustThinLTOBufferPtr(Buf)),
+                       LLVMRustThinLTOBufferLen(Buf)});
+    LLVMDisposeModule(Mod);
+    LLVMContextDispose(Ctx);
+  }
+  const char *Preserved[] = {"main"};
+  Samples S;
+  measure(Iters, S, [&] {
+    LLVMRustThinLTOData *Data = LLVMRustCreateThinLTOData(
+        Modules.data(), static_cast<int>(Modules.size()), Preserved, 1);
+    if (!Data)
+      fprintf(stderr, "error: %s\n", LastError.c_str());
+    else
+      LLVMRustFreeThinLTOData(Data);
+  });
+  S.report("thinlto-idx");
+  for (LLVMRustThinLTOBuffer *Buf : Buffers)
+    LLVMRustThinLTOBufferFree(Buf);
+  return 0;
+}
+
+static int benchSymbols(std::vector<InputFile> &Files, int Iters) {
+  Samples S;
+  measure(Iters, S, [&] {
+    for (InputFile &File : Files) {
+      size_t NumSymbols = 0;
+      void *Res = LLVMRustGetSymbols(
+          &File.Contents[0], File.Contents.size(), &NumSymbols,
+          [](void *State, const char *) -> void * {
+            ++*static_cast<size_t *>(State);
+            return nullptr;
+          },
+          [](const char *Err) -> void * {
+            fprintf(stderr, "error: %s\n", Err);
+            return const_cast<char *>(Err);
+          });
+      (void)Res;
+    }
+  });
+  S.report("symbols");
+  return 0;
+}
+
+static int benchArchive(const std::vector<InputFile> &Files, int Iters) {
+  std::string Dst = "wrapper-bench-out.a";
+  Samples S;
+  measure(Iters, S, [&] {
+    std::vector<RustArchiveMember *> Members;
+    for (const InputFile &File : Files) {
+      // File-backed members must carry a name; use the basename like rustc
+      // does. The pointer stays valid: it points into the stable Path.
+      size_t Slash = File.Path.rfind('/');
+      const char *Name =
+          File.Path.c_str() + (Slash == std::string::npos ? 0 : Slash + 1);
+      Members.push_back(
+          LLVMRustArchiveMemberNew(const_cast<char *>(File.Path.c_str()),
+                                   const_cast<char *>(Name), nullptr));
+    }
+    LLVMRustResult Res =
+        LLVMRustWriteArchive(const_cast<char *>(Dst.c_str()), Members.size(),
+                             Members.data(), /*WriteSymbtab=*/true,
+                             LLVMRustArchiveKind::GNU);
+    if (Res != LLVMRustResult::Success)
+      fprintf(stderr, "error: %s\n", LastError.c_str());
+    for (RustArchiveMember *Member : Members)
+      LLVMRustArchiveMemberFree(Member);
+  });
+  remove(Dst.c_str());
+  S.report("archive");
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    fprintf(stderr,
+            "usage: %s {optimize|thinlto-buf|thinlto-idx|symbols|archive} "
+            "<iterations> <file>...\n",
+            argv[0]);
+    return 2;
+  }
+  const char *Mode = argv[1];
+  int Iters = atoi(argv[2]);
+  if (Iters <= 0) {
+    fprintf(stderr, "error: bad iteration count '%s'\n", argv[2]);
+    return 2;
+  }
+
+  std::vector<InputFile> Files;
+  for (int i = 3; i < argc; i++) {
+    InputFile File;
+    if (!readFile(argv[i], File))
+      return 1;
+    Files.push_back(std::move(File));
+  }
+
+  if (strcmp(Mode, "optimize") == 0)
+    return benchOptimize(Files, Iters);
+  if (strcmp(Mode, "thinlto-buf") == 0)
+    return benchThinLTOBuffer(Files, Iters);
+  if (strcmp(Mode, "thinlto-idx") == 0)
+    return benchThinLTOIndex(Files, Iters);
+  if (strcmp(Mode, "symbols") == 0)
+    return benchSymbols(Files, Iters);
+  if (strcmp(Mode, "archive") == 0)
+    return benchArchive(Files, Iters);
+  fprintf(stderr, "error: unknown mode '%s'\n", Mode);
+  return 2;
+}
@@ -35,6 +35,14 @@ pub unsafe extern "C" fn LLVMRustStringWriteImpl(
     sr.bytes.borrow_mut().extend_from_slice(slice);
 }
 
+/// Reserving capacity in a Rust string ahead of a large write -- used by
+/// RawRustStringOstream when the C++ side knows the payload size up front,
+/// so multi-megabyte returns don't grow the vector by repeated reallocation.
+#[no_mangle]
+pub unsafe extern "C" fn LLVMRustStringReserveImpl(sr: &RustString, additional: size_t) {
+    sr.bytes.borrow_mut().reserve(additional);
+}
+
 /// Initialize targets enabled by the build script via `cfg(llvm_component = "...")`.
 /// N.B., this function can't be moved to `rustc_codegen_llvm` because of the `cfg`s.
 pub fn initialize_available_targets() {
@@ -0,0 +1,44 @@
+// C++ half of the unwind overhead benchmark; see README.md. The shapes
+// mirror ../foo.cpp, minus the correctness assertions.
+
+#include <stdint.h>
+
+struct exception {};
+
+extern "C" {
+    // Two identical no-ops so the Rust side can import one as plain
+    // `extern "C"` and the other as `extern "C-unwind"`; the symbols must
+    // differ because one declaration per symbol is allowed.
+    void bench_noop() {}
+    void bench_noop_unwind() {}
+
+    // Calls `cb` `iters` times in a tight loop, so the C++ -> Rust
+    // crossing is measured without a Rust-side loop around it.
+    void bench_call_n(void (*cb)(), uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++)
+            cb();
+    }
+
+    void bench_throw() { throw exception(); }
+
+    // One full round trip: `cb` (a Rust frame with a live destructor)
+    // calls back into bench_throw, and the exception unwinds through it
+    // to be caught here.
+    void bench_throw_through(void (*cb)()) {
+        try {
+            cb();
+        } catch (exception) {
+        }
+    }
+
+    // Lets a Rust panic pass through a C++ frame: catch (...) observes
+    // the foreign exception and rethrows, as a well-behaved boundary
+    // must.
+    void bench_rethrow_foreign(void (*cb)()) {
+        try {
+            cb();
+        } catch (...) {
+            throw;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+// Rust half of the unwind overhead benchmark; see README.md. Each
+// scenario prints iterations per second so invoke/cleanup codegen changes
+// show up as a throughput delta across builds.
+
+use std::hint::black_box;
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::time::Instant;
+
+extern "C" {
+    fn bench_noop();
+    fn bench_call_n(cb: extern "C" fn(), iters: u64);
+}
+
+extern "C-unwind" {
+    fn bench_noop_unwind();
+    fn bench_throw();
+    fn bench_throw_through(cb: extern "C-unwind" fn());
+    fn bench_rethrow_foreign(cb: extern "C-unwind" fn());
+}
+
+static mut DROPS: u64 = 0;
+
+// The Rust frame the C++ exception unwinds through; the guard keeps a
+// cleanup landing pad live, like DropCheck in ../foo.rs.
+extern "C-unwind" fn call_cxx_throw() {
+    struct Guard;
+    impl Drop for Guard {
+        fn drop(&mut self) {
+            unsafe { DROPS += 1 }
+        }
+    }
+    let _guard = Guard;
+    unsafe { bench_throw() };
+}
+
+extern "C-unwind" fn rust_panic_cb() {
+    std::panic::panic_any(1234i32);
+}
+
+extern "C" fn noop_rust() {}
+
+fn measure(name: &str, iters: u64, f: impl FnOnce()) {
+    let start = Instant::now();
+    f();
+    let secs = start.elapsed().as_secs_f64();
+    println!("{:<16} {:>12} iters  {:>8.3}s  {:>14.0}/s", name, iters, secs, iters as f64 / secs);
+}
+
+fn main() {
+    let scale: u64 = std::env::args().nth(1).and_then(|a| a.parse().ok()).unwrap_or(1);
+    let calls = 100_000_000 * scale;
+    let unwinds = 200_000 * scale;
+
+    // The default hook would print a backtrace for every panic-round-trip
+    // iteration.
+    std::panic::set_hook(Box::new(|_| {}));
+
+    measure("happy-c", calls, || {
+        for _ in 0..calls {
+            unsafe { bench_noop() };
+        }
+    });
+
+    measure("happy-c-unwind", calls, || {
+        for _ in 0..calls {
+            unsafe { bench_noop_unwind() };
+        }
+    });
+
+    measure("rust-callee", calls, || unsafe { bench_call_n(noop_rust, calls) });
+
+    measure("cxx-round-trip", unwinds, || {
+        for _ in 0..unwinds {
+            unsafe { bench_throw_through(call_cxx_throw) };
+        }
+    });
+    assert_eq!(unsafe { DROPS }, unwinds, "cleanups must run on every unwind");
+
+    measure("panic-round-trip", unwinds, || {
+        for _ in 0..unwinds {
+            let caught = catch_unwind(AssertUnwindSafe(|| unsafe {
+                bench_rethrow_foreign(rust_panic_cb)
+            }));
+            black_box(caught.is_err());
+        }
+    });
+}
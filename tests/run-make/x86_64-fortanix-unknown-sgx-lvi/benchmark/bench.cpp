@@ -0,0 +1,99 @@
+// Kernels for measuring LVI mitigation overhead; see README.md. Build
+// twice, with and without -mlvi-hardening -mlvi-cfi, and compare.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+volatile uint64_t sink;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+void report(const char *name, uint64_t ops, double secs) {
+    printf("%-10s %12llu ops  %8.3fs  %14.0f ops/s\n", name,
+           (unsigned long long)ops, secs, ops / secs);
+}
+
+// Sequential loads: the streaming-read bound for per-load fencing.
+void bench_sum_seq(const std::vector<uint64_t> &data, uint64_t reps) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum = 0;
+    for (uint64_t r = 0; r < reps; r++)
+        for (uint64_t v : data)
+            sum += v;
+    sink = sum;
+    report("sum-seq", reps * data.size(), seconds_since(start));
+}
+
+// Dependent loads through a shuffled permutation: every load's address
+// comes from the previous load, so a fence per load is paid in full.
+void bench_chase(const std::vector<uint64_t> &next, uint64_t steps) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t i = 0;
+    for (uint64_t s = 0; s < steps; s++)
+        i = next[i];
+    sink = i;
+    report("chase", steps, seconds_since(start));
+}
+
+__attribute__((noinline)) uint64_t callee(uint64_t x) { return x + 1; }
+
+// Call/ret in a tight loop: LVI CFI rewrites the ret, and this is where
+// that shows.
+void bench_call_ret(uint64_t calls) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t acc = 0;
+    for (uint64_t i = 0; i < calls; i++)
+        acc = callee(acc);
+    sink = acc;
+    report("call-ret", calls, seconds_since(start));
+}
+
+void bench_indirect(uint64_t calls) {
+    uint64_t (*volatile fn)(uint64_t) = callee;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t acc = 0;
+    for (uint64_t i = 0; i < calls; i++)
+        acc = fn(acc);
+    sink = acc;
+    report("indirect", calls, seconds_since(start));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    uint64_t scale = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+
+    const size_t N = 8 * 1024 * 1024; // 64 MB of uint64_t
+    std::vector<uint64_t> data(N, 1);
+
+    // Sattolo's algorithm: a single cycle visiting every element, so the
+    // chase never settles into a short loop.
+    std::vector<uint64_t> next(N);
+    for (size_t i = 0; i < N; i++)
+        next[i] = i;
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (size_t i = N - 1; i > 0; i--) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t j = state % i;
+        uint64_t tmp = next[i];
+        next[i] = next[j];
+        next[j] = tmp;
+    }
+
+    bench_sum_seq(data, 20 * scale);
+    bench_chase(next, 50'000'000 * scale);
+    bench_call_ret(500'000'000 * scale);
+    bench_indirect(500'000'000 * scale);
+    return 0;
+}